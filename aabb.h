@@ -44,6 +44,39 @@ static inline int aabb_hit(aabb box, ray r, double t_min, double t_max) {
     return 1;
 }
 
+/*
+ * Slab test with a precomputed reciprocal direction, for traversals that test
+ * many boxes against one ray. Returns the entry distance through *t_enter.
+ */
+static inline int aabb_hit_inv(const aabb *box, vec3 origin, vec3 inv_dir,
+                               double t_min, double t_max, double *t_enter) {
+    double tx0 = (box->min.x - origin.x) * inv_dir.x;
+    double tx1 = (box->max.x - origin.x) * inv_dir.x;
+    double ty0 = (box->min.y - origin.y) * inv_dir.y;
+    double ty1 = (box->max.y - origin.y) * inv_dir.y;
+    double tz0 = (box->min.z - origin.z) * inv_dir.z;
+    double tz1 = (box->max.z - origin.z) * inv_dir.z;
+    t_min = fmax(t_min, fmax(fmin(tx0, tx1), fmax(fmin(ty0, ty1), fmin(tz0, tz1))));
+    t_max = fmin(t_max, fmin(fmax(tx0, tx1), fmin(fmax(ty0, ty1), fmax(tz0, tz1))));
+    *t_enter = t_min;
+    return t_min <= t_max;
+}
+
+/* Inverted box that any point or box expands */
+static inline aabb aabb_empty(void) {
+    return aabb_create(vec3_create(1e30, 1e30, 1e30), vec3_create(-1e30, -1e30, -1e30));
+}
+
+static inline aabb aabb_extend(aabb box, vec3 p) {
+    return aabb_create(
+        vec3_create(fmin(box.min.x, p.x), fmin(box.min.y, p.y), fmin(box.min.z, p.z)),
+        vec3_create(fmax(box.max.x, p.x), fmax(box.max.y, p.y), fmax(box.max.z, p.z)));
+}
+
+static inline vec3 aabb_centroid(aabb box) {
+    return vec3_scale(vec3_add(box.min, box.max), 0.5);
+}
+
 static inline aabb surrounding_box(aabb box0, aabb box1) {
     vec3 small_v = {
         fmin(box0.min.x, box1.min.x),
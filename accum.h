@@ -0,0 +1,264 @@
+#ifndef ACCUM_H
+#define ACCUM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vec3.h"
+#include "color.h"
+
+/*
+ * Accumulation buffer: unnormalised radiance sums plus a sample count per
+ * pixel, so partial renders (tile, sample or frame shards) can be summed
+ * and resolved later. A buffer holds rows [y0, y0 + rows) of a width x height
+ * image; rows are stored top-down like the output image.
+ */
+/* Shard work: tiles [tile_begin, tile_end) x samples [sample_begin, sample_end) of a frame */
+typedef struct {
+    int32_t tile_begin, tile_end;
+    int32_t sample_begin, sample_end;
+} accum_range;
+
+typedef struct {
+    int width, height;  /* full image size */
+    int y0, rows;       /* band of rows held by this buffer */
+    int frame;
+    float *rgb;         /* radiance sums, 3 floats per pixel */
+    uint32_t *samples;  /* samples accumulated per pixel */
+    accum_range *ranges;    /* shard work summed in, so merges can refuse to add any twice */
+    int num_ranges;
+} accum_buffer;
+
+/* On-disk header of a partial accumulation file (".acc"), host byte order */
+#define ACCUM_MAGIC "VTACCUM"
+#define ACCUM_VERSION 1
+#define ACCUM_MAX_RANGES 65536  /* more in a file means it is corrupt */
+
+/* Followed by num_ranges accum_range records, the sums and the sample counts */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    int32_t y0, rows;
+    int32_t frame;
+    int32_t num_ranges;
+} accum_file_header;
+
+static inline int accum_create(accum_buffer *acc, int width, int height, int y0, int rows) {
+    size_t n = (size_t)width * rows;
+    acc->width = width;
+    acc->height = height;
+    acc->y0 = y0;
+    acc->rows = rows;
+    acc->frame = 0;
+    acc->ranges = NULL;
+    acc->num_ranges = 0;
+    acc->rgb = (float *)calloc(n * 3, sizeof(float));
+    acc->samples = (uint32_t *)calloc(n, sizeof(uint32_t));
+    if (!acc->rgb || !acc->samples) {
+        free(acc->rgb);
+        free(acc->samples);
+        acc->rgb = NULL;
+        acc->samples = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void accum_free(accum_buffer *acc) {
+    free(acc->rgb);
+    free(acc->samples);
+    free(acc->ranges);
+    acc->rgb = NULL;
+    acc->samples = NULL;
+    acc->ranges = NULL;
+    acc->num_ranges = 0;
+}
+
+/* Records that `r` was summed into the buffer; returns 0, or -1 if out of memory */
+static inline int accum_add_range(accum_buffer *acc, accum_range r) {
+    accum_range *grown = (accum_range *)realloc(acc->ranges, sizeof(*grown) * (size_t)(acc->num_ranges + 1));
+    if (!grown)
+        return -1;
+    acc->ranges = grown;
+    acc->ranges[acc->num_ranges++] = r;
+    return 0;
+}
+
+static inline int accum_ranges_overlap(accum_range a, accum_range b) {
+    return a.tile_begin < b.tile_end && b.tile_begin < a.tile_end
+        && a.sample_begin < b.sample_end && b.sample_begin < a.sample_end;
+}
+
+static inline void accum_clear(accum_buffer *acc) {
+    size_t n = (size_t)acc->width * acc->rows;
+    memset(acc->rgb, 0, n * 3 * sizeof(float));
+    memset(acc->samples, 0, n * sizeof(uint32_t));
+}
+
+/* Clears pixels [x0, x1) x [y0, y1), y counted from the top; rows outside the buffer are skipped */
+static inline void accum_clear_rect(accum_buffer *acc, int x0, int y0, int x1, int y1) {
+    for (int y = y0 < acc->y0 ? acc->y0 : y0; y < y1 && y < acc->y0 + acc->rows; y++) {
+        size_t idx = (size_t)(y - acc->y0) * acc->width + x0;
+        memset(&acc->rgb[idx * 3], 0, (size_t)(x1 - x0) * 3 * sizeof(float));
+        memset(&acc->samples[idx], 0, (size_t)(x1 - x0) * sizeof(uint32_t));
+    }
+}
+
+/* Adds `n` samples summing to `sum` at image pixel (x, y), y counted from the top */
+static inline void accum_add(accum_buffer *acc, int x, int y, vec3 sum, int n) {
+    size_t idx = (size_t)(y - acc->y0) * acc->width + x;
+    acc->rgb[idx * 3]     += (float)sum.x;
+    acc->rgb[idx * 3 + 1] += (float)sum.y;
+    acc->rgb[idx * 3 + 2] += (float)sum.z;
+    acc->samples[idx] += (uint32_t)n;
+}
+
+/* Adds the overlapping rows of `src` into `dst`; both must share an image size. */
+static inline void accum_merge(accum_buffer *dst, const accum_buffer *src) {
+    int lo = src->y0 > dst->y0 ? src->y0 : dst->y0;
+    int hi_s = src->y0 + src->rows, hi_d = dst->y0 + dst->rows;
+    int hi = hi_s < hi_d ? hi_s : hi_d;
+    for (int y = lo; y < hi; y++) {
+        size_t ds = (size_t)(y - dst->y0) * dst->width;
+        size_t ss = (size_t)(y - src->y0) * src->width;
+        for (int x = 0; x < dst->width; x++) {
+            dst->rgb[(ds + x) * 3]     += src->rgb[(ss + x) * 3];
+            dst->rgb[(ds + x) * 3 + 1] += src->rgb[(ss + x) * 3 + 1];
+            dst->rgb[(ds + x) * 3 + 2] += src->rgb[(ss + x) * 3 + 2];
+            dst->samples[ds + x] += src->samples[ss + x];
+        }
+    }
+}
+
+/*
+ * Gives pixels without samples those of the matching pixel of `src`, a whole
+ * image at a lower resolution (pixel replication, as when writing it scaled up).
+ */
+static inline void accum_fill_unsampled(accum_buffer *acc, const accum_buffer *src) {
+    for (int r = 0; r < acc->rows; r++) {
+        int sy = (int)((long)(acc->y0 + r) * src->rows / acc->height);
+        for (int x = 0; x < acc->width; x++) {
+            size_t idx = (size_t)r * acc->width + x;
+            if (acc->samples[idx] != 0)
+                continue;
+            size_t sidx = (size_t)sy * src->width + (int)((long)x * src->width / acc->width);
+            memcpy(&acc->rgb[idx * 3], &src->rgb[sidx * 3], 3 * sizeof(float));
+            acc->samples[idx] = src->samples[sidx];
+        }
+    }
+}
+
+/*
+ * Resolves the buffer to gamma-corrected 8-bit RGB, one row of `width` pixels
+ * per buffer row. Pixels without samples come out black; returns their count.
+ */
+static inline long accum_resolve(const accum_buffer *acc, unsigned char *buf) {
+    long missing = 0;
+    size_t n = (size_t)acc->width * acc->rows;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t count = acc->samples[i];
+        if (count == 0) {
+            buf[i * 3] = buf[i * 3 + 1] = buf[i * 3 + 2] = 0;
+            missing++;
+            continue;
+        }
+        vec3 sum = vec3_create(acc->rgb[i * 3], acc->rgb[i * 3 + 1], acc->rgb[i * 3 + 2]);
+        write_color_to_buffer(buf, (int)(i * 3), sum, (int)count);
+    }
+    return missing;
+}
+
+/* Writes the buffer (header and data) at the current position of `f`; returns 0, or -1 on a write error */
+static inline int accum_write(const accum_buffer *acc, FILE *f) {
+    accum_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ACCUM_MAGIC, sizeof(h.magic));
+    h.version = ACCUM_VERSION;
+    h.width = acc->width;
+    h.height = acc->height;
+    h.y0 = acc->y0;
+    h.rows = acc->rows;
+    h.frame = acc->frame;
+    h.num_ranges = acc->num_ranges;
+
+    size_t n = (size_t)acc->width * acc->rows;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1
+          && fwrite(acc->ranges, sizeof(accum_range), (size_t)acc->num_ranges, f) == (size_t)acc->num_ranges
+          && fwrite(acc->rgb, sizeof(float), n * 3, f) == n * 3
+          && fwrite(acc->samples, sizeof(uint32_t), n, f) == n;
+    return ok ? 0 : -1;
+}
+
+static inline int accum_save(const accum_buffer *acc, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        return -1;
+    }
+    int ok = accum_write(acc, f) == 0;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads a buffer written by accum_write from `f` into a freshly created
+ * buffer; `path` names the file in error messages.
+ */
+static inline int accum_read(accum_buffer *acc, FILE *f, const char *path) {
+    accum_file_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, ACCUM_MAGIC, sizeof(h.magic)) != 0
+        || h.version != ACCUM_VERSION) {
+        fprintf(stderr, "Error: %s is not an accumulation file\n", path);
+        return -1;
+    }
+    if (h.width <= 0 || h.height <= 0 || h.y0 < 0 || h.rows <= 0 || h.y0 + h.rows > h.height
+        || h.num_ranges < 0 || h.num_ranges > ACCUM_MAX_RANGES) {
+        fprintf(stderr, "Error: %s has an invalid header\n", path);
+        return -1;
+    }
+    if (accum_create(acc, h.width, h.height, h.y0, h.rows) != 0) {
+        fprintf(stderr, "Error: Failed to allocate buffer for %s\n", path);
+        return -1;
+    }
+    acc->frame = h.frame;
+    acc->ranges = (accum_range *)malloc(sizeof(accum_range) * (size_t)(h.num_ranges ? h.num_ranges : 1));
+    if (!acc->ranges) {
+        fprintf(stderr, "Error: Failed to allocate buffer for %s\n", path);
+        accum_free(acc);
+        return -1;
+    }
+    acc->num_ranges = h.num_ranges;
+
+    size_t n = (size_t)h.width * h.rows;
+    int ok = fread(acc->ranges, sizeof(accum_range), (size_t)h.num_ranges, f) == (size_t)h.num_ranges
+          && fread(acc->rgb, sizeof(float), n * 3, f) == n * 3
+          && fread(acc->samples, sizeof(uint32_t), n, f) == n;
+    if (!ok) {
+        fprintf(stderr, "Error: %s is truncated\n", path);
+        accum_free(acc);
+        return -1;
+    }
+    return 0;
+}
+
+/* Loads a partial file into a freshly created buffer. */
+static inline int accum_load(accum_buffer *acc, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        return -1;
+    }
+    int rc = accum_read(acc, f, path);
+    fclose(f);
+    return rc;
+}
+
+#endif
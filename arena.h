@@ -0,0 +1,121 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Arena: a bump allocator over a list of large blocks. Allocations are never
+ * freed individually and never move; arena_free releases everything at once.
+ */
+#define ARENA_BLOCK_SIZE (4u << 20)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} arena_block;
+
+typedef struct {
+    arena_block *head;
+    size_t reserved;    /* bytes held in blocks */
+} arena;
+
+/* `align` must be a power of two */
+static inline void *arena_alloc(arena *a, size_t size, size_t align) {
+    arena_block *b = a->head;
+    if (b) {
+        uintptr_t base = (uintptr_t)b->data;
+        size_t offset = ((base + b->used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (offset + size <= b->size) {
+            b->used = offset + size;
+            return b->data + offset;
+        }
+    }
+
+    /* New block, with slack so the first allocation can be aligned */
+    size_t block_size = size + align > ARENA_BLOCK_SIZE ? size + align : ARENA_BLOCK_SIZE;
+    b = (arena_block *)malloc(sizeof(arena_block) + block_size);
+    if (!b) return NULL;
+    b->next = a->head;
+    b->size = block_size;
+    b->used = 0;
+    a->head = b;
+    a->reserved += block_size;
+    return arena_alloc(a, size, align);
+}
+
+static inline void arena_free(arena *a) {
+    arena_block *b = a->head;
+    while (b) {
+        arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->reserved = 0;
+}
+
+/*
+ * Growable array backed by an arena. Elements live in fixed-size chunks that
+ * never move, so an element's handle (its index) and its address stay valid
+ * however large the array grows; only the small chunk table is reallocated.
+ */
+#define ARENA_CHUNK_SHIFT 10
+#define ARENA_CHUNK_LEN (1u << ARENA_CHUNK_SHIFT)
+
+typedef struct {
+    size_t elem_size;
+    unsigned char **chunks;
+    uint32_t num_chunks, cap_chunks;
+    uint32_t count;
+} arena_array;
+
+static inline void arena_array_init(arena_array *arr, size_t elem_size) {
+    arr->elem_size = elem_size;
+    arr->chunks = NULL;
+    arr->num_chunks = arr->cap_chunks = 0;
+    arr->count = 0;
+}
+
+/* Drops the chunk table; the chunks themselves go with their arena */
+static inline void arena_array_free(arena_array *arr) {
+    free(arr->chunks);
+    arena_array_init(arr, arr->elem_size);
+}
+
+static inline void *arena_array_at(const arena_array *arr, uint32_t handle) {
+    return arr->chunks[handle >> ARENA_CHUNK_SHIFT]
+         + (size_t)(handle & (ARENA_CHUNK_LEN - 1)) * arr->elem_size;
+}
+
+/* Number of elements stored in chunk `c` */
+static inline uint32_t arena_array_chunk_len(const arena_array *arr, uint32_t c) {
+    uint32_t start = c << ARENA_CHUNK_SHIFT;
+    return arr->count - start < ARENA_CHUNK_LEN ? arr->count - start : ARENA_CHUNK_LEN;
+}
+
+/* Appends a copy of `elem`; returns its handle, or UINT32_MAX if out of memory */
+static inline uint32_t arena_array_push(arena_array *arr, arena *a, const void *elem) {
+    if (arr->count == UINT32_MAX)
+        return UINT32_MAX;
+    if ((arr->count & (ARENA_CHUNK_LEN - 1)) == 0 && (arr->count >> ARENA_CHUNK_SHIFT) == arr->num_chunks) {
+        if (arr->num_chunks == arr->cap_chunks) {
+            uint32_t cap = arr->cap_chunks ? arr->cap_chunks * 2 : 16;
+            unsigned char **grown = (unsigned char **)realloc(arr->chunks, sizeof(*grown) * cap);
+            if (!grown) return UINT32_MAX;
+            arr->chunks = grown;
+            arr->cap_chunks = cap;
+        }
+        unsigned char *chunk = (unsigned char *)arena_alloc(a, arr->elem_size * ARENA_CHUNK_LEN, 64);
+        if (!chunk) return UINT32_MAX;
+        arr->chunks[arr->num_chunks++] = chunk;
+    }
+    uint32_t handle = arr->count++;
+    memcpy(arena_array_at(arr, handle), elem, arr->elem_size);
+    return handle;
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdlib.h>
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "material.h"
+
+/*
+ * Bounding volume hierarchy over an array of primitive boxes. Nodes are laid
+ * out depth first: an inner node's left child directly follows it and `right`
+ * indexes the other one; a leaf covers `count` entries of `prims` from `start`.
+ * Primitives are referred to by their index in the array passed to bvh_build.
+ */
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK_SIZE 64
+
+typedef struct {
+    aabb box;
+    int start;      /* leaf: first entry in prims; inner: unused */
+    int count;      /* leaf: number of prims; inner: 0 */
+    int right;      /* inner: index of the right child */
+} bvh_node;
+
+typedef struct {
+    bvh_node *nodes;
+    int num_nodes;
+    int *prims;
+    int num_prims;
+} bvh;
+
+/* Intersects primitive `prim` of the structure described by `ctx` */
+typedef int (*bvh_prim_hit_fn)(const void *ctx, int prim, ray r, double t_min, double t_max, hit_record *rec);
+
+static inline double bvh_axis(vec3 v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+/* Quickselect on centroid coordinate: puts the k-th smallest of prims[lo, hi) at k */
+static inline void bvh_select(int *prims, const vec3 *centroids, int lo, int hi, int k, int axis) {
+    hi--;
+    while (lo < hi) {
+        double pivot = bvh_axis(centroids[prims[(lo + hi) / 2]], axis);
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (bvh_axis(centroids[prims[i]], axis) < pivot) i++;
+            while (bvh_axis(centroids[prims[j]], axis) > pivot) j--;
+            if (i <= j) {
+                int tmp = prims[i]; prims[i] = prims[j]; prims[j] = tmp;
+                i++; j--;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else return;
+    }
+}
+
+static inline int bvh_build_node(bvh *b, const aabb *boxes, const vec3 *centroids, int lo, int hi, int depth) {
+    int index = b->num_nodes++;
+    bvh_node *node = &b->nodes[index];
+
+    aabb bounds = aabb_empty();
+    aabb cbounds = aabb_empty();
+    for (int i = lo; i < hi; i++) {
+        bounds = surrounding_box(bounds, boxes[b->prims[i]]);
+        cbounds = aabb_extend(cbounds, centroids[b->prims[i]]);
+    }
+    node->box = bounds;
+
+    /* Depth is capped so traversal never overflows its fixed stack */
+    if (hi - lo <= BVH_LEAF_SIZE || depth >= BVH_STACK_SIZE - 2) {
+        node->start = lo;
+        node->count = hi - lo;
+        node->right = -1;
+        return index;
+    }
+
+    /* Object median split along the widest axis of the centroids */
+    vec3 extent = vec3_sub(cbounds.max, cbounds.min);
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > bvh_axis(extent, axis)) axis = 2;
+    int mid = (lo + hi) / 2;
+    bvh_select(b->prims, centroids, lo, hi, mid, axis);
+
+    node->start = lo;
+    node->count = 0;
+    bvh_build_node(b, boxes, centroids, lo, mid, depth + 1);
+    int right = bvh_build_node(b, boxes, centroids, mid, hi, depth + 1);
+    b->nodes[index].right = right;
+    return index;
+}
+
+/* Builds `b` over `n` boxes; returns 0 on success, -1 if out of memory */
+static inline int bvh_build(bvh *b, const aabb *boxes, int n) {
+    b->nodes = NULL;
+    b->prims = NULL;
+    b->num_nodes = 0;
+    b->num_prims = n;
+    if (n == 0)
+        return 0;
+
+    /* Leaves hold at least two primitives once n > BVH_LEAF_SIZE, so n nodes suffice */
+    b->nodes = (bvh_node *)malloc(sizeof(bvh_node) * (size_t)n);
+    b->prims = (int *)malloc(sizeof(int) * (size_t)n);
+    vec3 *centroids = (vec3 *)malloc(sizeof(vec3) * (size_t)n);
+    if (!b->nodes || !b->prims || !centroids) {
+        free(b->nodes);
+        free(b->prims);
+        free(centroids);
+        b->nodes = NULL;
+        b->prims = NULL;
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        b->prims[i] = i;
+        centroids[i] = aabb_centroid(boxes[i]);
+    }
+    bvh_build_node(b, boxes, centroids, 0, n, 0);
+    free(centroids);
+    return 0;
+}
+
+static inline void bvh_free(bvh *b) {
+    free(b->nodes);
+    free(b->prims);
+    b->nodes = NULL;
+    b->prims = NULL;
+    b->num_nodes = 0;
+    b->num_prims = 0;
+}
+
+static inline vec3 bvh_inv_dir(vec3 d) {
+    return vec3_create(
+        (fabs(d.x) > 1e-15) ? 1.0 / d.x : 1e15,
+        (fabs(d.y) > 1e-15) ? 1.0 / d.y : 1e15,
+        (fabs(d.z) > 1e-15) ? 1.0 / d.z : 1e15);
+}
+
+/* Closest hit among the primitives in `b`, nearest child first */
+static inline int bvh_hit(const bvh *b, ray r, double t_min, double t_max, hit_record *rec,
+                          bvh_prim_hit_fn hit_prim, const void *ctx) {
+    if (b->num_nodes == 0)
+        return 0;
+
+    vec3 inv_dir = bvh_inv_dir(r.direction);
+    int stack[BVH_STACK_SIZE];
+    int sp = 0;
+    int hit_anything = 0;
+    double closest_so_far = t_max;
+    double t_enter;
+
+    if (!aabb_hit_inv(&b->nodes[0].box, r.origin, inv_dir, t_min, closest_so_far, &t_enter))
+        return 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const bvh_node *node = &b->nodes[stack[--sp]];
+        if (node->count > 0) {
+            for (int i = node->start; i < node->start + node->count; i++) {
+                if (hit_prim(ctx, b->prims[i], r, t_min, closest_so_far, rec)) {
+                    hit_anything = 1;
+                    closest_so_far = rec->t;
+                }
+            }
+            continue;
+        }
+
+        int left = (int)(node - b->nodes) + 1;
+        int right = node->right;
+        double t_left, t_right;
+        int hit_left = aabb_hit_inv(&b->nodes[left].box, r.origin, inv_dir, t_min, closest_so_far, &t_left);
+        int hit_right = aabb_hit_inv(&b->nodes[right].box, r.origin, inv_dir, t_min, closest_so_far, &t_right);
+        if (hit_left && hit_right) {
+            /* Push the farther child first so the nearer one is visited next */
+            if (t_left < t_right) { stack[sp++] = right; stack[sp++] = left; }
+            else                  { stack[sp++] = left;  stack[sp++] = right; }
+        } else if (hit_left) {
+            stack[sp++] = left;
+        } else if (hit_right) {
+            stack[sp++] = right;
+        }
+    }
+    return hit_anything;
+}
+
+#endif
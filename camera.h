@@ -43,6 +43,19 @@ static inline camera camera_create(vec3 lookfrom, vec3 lookat, vec3 vup,
     return cam;
 }
 
+/* Where a camera is and how it is set up, before it is built for an aspect ratio */
+typedef struct {
+    vec3 lookfrom, lookat, vup;
+    double vfov;        /* vertical field of view in degrees */
+    double aperture;
+    double focus_dist;
+} camera_view;
+
+static inline camera camera_from_view(const camera_view *view, double aspect_ratio) {
+    return camera_create(view->lookfrom, view->lookat, view->vup, view->vfov,
+                         aspect_ratio, view->aperture, view->focus_dist);
+}
+
 static inline ray camera_get_ray(camera *cam, double s, double t) {
     vec3 rd = vec3_scale(random_in_unit_disk(), cam->lens_radius);
     vec3 offset = vec3_add(vec3_scale(cam->u, rd.x), vec3_scale(cam->v, rd.y));
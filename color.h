@@ -38,4 +38,19 @@ static inline void write_color_to_buffer(unsigned char *buf, int idx, vec3 pixel
     buf[idx + 2] = (unsigned char)clamp_int((int)(256 * fmin(fmax(b, 0.0), 0.999)), 0, 255);
 }
 
+/* Writes `rows` rows of RGB24 pixels as the body of a plain PPM */
+static inline void write_ppm_rows(FILE *out, const unsigned char *buf, int width, int rows) {
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < width; i++) {
+            size_t idx = ((size_t)j * width + i) * 3;
+            fprintf(out, "%d %d %d\n", buf[idx], buf[idx + 1], buf[idx + 2]);
+        }
+    }
+}
+
+static inline void write_ppm(FILE *out, const unsigned char *buf, int width, int height) {
+    fprintf(out, "P3\n%d %d\n255\n", width, height);
+    write_ppm_rows(out, buf, width, height);
+}
+
 #endif
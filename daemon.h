@@ -0,0 +1,363 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "accum.h"
+#include "render.h"
+
+/*
+ * Render daemon: builds a scene once, keeps it and its BVH resident, and
+ * renders requests arriving on a Unix stream socket on one shared worker pool.
+ *
+ * A client sends a daemon_request (host byte order; client and daemon are the
+ * same build) and reads back a daemon_reply naming a POSIX shared memory
+ * object that holds the RGB24 image. The client maps the object and unlinks
+ * it once done. A connection carries any number of requests, one at a time;
+ * clients wanting several renders in flight open several connections.
+ */
+#define DAEMON_MAGIC 0x56544452u   /* "VTDR" */
+#define DAEMON_VERSION 1
+#define DAEMON_MAX_SIZE 16384       /* largest image width or height */
+#define DAEMON_MAX_SAMPLES 65536
+#define DAEMON_MAX_DEPTH 1000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    char scene_name[32];            /* must be the scene the daemon serves */
+    camera_view view;
+    int32_t width, height;          /* image the camera covers */
+    int32_t crop_x, crop_y;         /* region actually rendered and returned */
+    int32_t crop_width, crop_height;
+    int32_t samples, max_depth;
+    int32_t priority;               /* higher-priority requests take workers first */
+    uint32_t seed;
+} daemon_request;
+
+typedef struct {
+    int32_t status;                 /* 0, or -1 with `message` set */
+    int32_t width, height;          /* image in the shared memory object */
+    double seconds;                 /* time from arrival to image ready */
+    char shm_name[64];
+    char message[128];
+} daemon_reply;
+
+typedef struct {
+    scene *world;
+    radiance_cache *cache;          /* shared by all requests, or NULL */
+    const char *scene_name;
+    render_pool pool;
+    atomic_uint next_image;         /* numbers shared memory objects */
+} daemon_server;
+
+typedef struct {
+    daemon_server *server;
+    int fd;
+} daemon_connection;
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_on_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+/* Reads exactly `n` bytes; returns 1, 0 on end of stream before any byte, or -1 */
+static inline int daemon_read_full(int fd, void *buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, (char *)buf + got, n - got);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return (r == 0 && got == 0) ? 0 : -1;
+        got += (size_t)r;
+    }
+    return 1;
+}
+
+/* Writes all of `buf`; a vanished peer is an error, not a SIGPIPE */
+static inline int daemon_write_full(int fd, const void *buf, size_t n) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t w = send(fd, (const char *)buf + sent, n - sent, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        sent += (size_t)w;
+    }
+    return 0;
+}
+
+static inline int daemon_fail(daemon_reply *rep, const char *message) {
+    rep->status = -1;
+    snprintf(rep->message, sizeof(rep->message), "%s", message);
+    return -1;
+}
+
+static inline int daemon_check_request(const daemon_server *d, const daemon_request *req, daemon_reply *rep) {
+    if (req->magic != DAEMON_MAGIC || req->version != DAEMON_VERSION)
+        return daemon_fail(rep, "protocol mismatch (daemon and client are different builds)");
+    if (strncmp(req->scene_name, d->scene_name, sizeof(req->scene_name)) != 0) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "this daemon serves scene '%s'", d->scene_name);
+        return daemon_fail(rep, msg);
+    }
+    if (req->width < 2 || req->height < 2 || req->width > DAEMON_MAX_SIZE || req->height > DAEMON_MAX_SIZE)
+        return daemon_fail(rep, "image size out of range");
+    if (req->crop_x < 0 || req->crop_y < 0 || req->crop_width < 1 || req->crop_height < 1
+        || req->crop_width > req->width - req->crop_x || req->crop_height > req->height - req->crop_y)
+        return daemon_fail(rep, "crop region outside the image");
+    if (req->samples < 1 || req->samples > DAEMON_MAX_SAMPLES || req->max_depth < 1
+        || req->max_depth > DAEMON_MAX_DEPTH)
+        return daemon_fail(rep, "samples or depth out of range");
+    return 0;
+}
+
+/* Renders one request into a new shared memory object named in `rep` */
+static inline int daemon_render(daemon_server *d, const daemon_request *req, daemon_reply *rep) {
+    double start = render_clock();
+    memset(rep, 0, sizeof(*rep));
+    if (daemon_check_request(d, req, rep) != 0)
+        return -1;
+
+    accum_buffer acc;
+    if (accum_create(&acc, req->crop_width, req->crop_height, 0, req->crop_height) != 0)
+        return daemon_fail(rep, "out of memory");
+
+    camera cam = camera_from_view(&req->view, (double)req->width / req->height);
+    render_job job;
+    render_task task;
+    render_job_init(&job, d->world, cam, req->crop_width, req->crop_height, req->max_depth, &acc, req->seed, 0);
+    job.full_width = req->width;
+    job.full_height = req->height;
+    job.crop_x = req->crop_x;
+    job.crop_y = req->crop_y;
+    job.sample_end = req->samples;
+    job.cache = d->cache;
+    render_pool_submit(&d->pool, &task, &job, req->priority);
+    render_pool_wait(&d->pool, &task);
+
+    size_t size = (size_t)req->crop_width * req->crop_height * 3;
+    snprintf(rep->shm_name, sizeof(rep->shm_name), "/vibe-tracing-%ld-%u",
+             (long)getpid(), atomic_fetch_add(&d->next_image, 1));
+    int fd = shm_open(rep->shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        accum_free(&acc);
+        return daemon_fail(rep, "failed to create shared memory");
+    }
+    void *pixels = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pixels == MAP_FAILED) {
+        shm_unlink(rep->shm_name);
+        accum_free(&acc);
+        return daemon_fail(rep, "failed to map shared memory");
+    }
+    accum_resolve(&acc, (unsigned char *)pixels);
+    munmap(pixels, size);
+    accum_free(&acc);
+
+    rep->width = req->crop_width;
+    rep->height = req->crop_height;
+    rep->seconds = render_clock() - start;
+    return 0;
+}
+
+static void *daemon_connection_thread(void *arg) {
+    daemon_connection conn = *(daemon_connection *)arg;
+    free(arg);
+
+    daemon_request req;
+    daemon_reply rep;
+    while (daemon_read_full(conn.fd, &req, sizeof(req)) == 1) {
+        int rc = daemon_render(conn.server, &req, &rep);
+        if (rc == 0)
+            fprintf(stderr, "Rendered %dx%d at (%d, %d) of %dx%d, %d samples/pixel, priority %d in %.2f seconds.\n",
+                    rep.width, rep.height, req.crop_x, req.crop_y, req.width, req.height,
+                    req.samples, req.priority, rep.seconds);
+        if (daemon_write_full(conn.fd, &rep, sizeof(rep)) != 0) {
+            /* Nobody will read the image */
+            if (rc == 0)
+                shm_unlink(rep.shm_name);
+            break;
+        }
+    }
+    close(conn.fd);
+    return NULL;
+}
+
+/* Binds a listening socket at `path`, replacing a stale socket left by a dead daemon */
+static inline int daemon_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Failed to create socket\n");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int alive = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0)
+            close(probe);
+        struct stat st;
+        if (!alive && stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "Error: %s is in use\n", path);
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 64) != 0) {
+        fprintf(stderr, "Error: Failed to listen on %s\n", path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Serves render requests on `path` until SIGINT or SIGTERM. The scene must be
+ * built and committed; it is shared read-only by all requests. A radiance
+ * cache, being in world space, stays valid across requests and keeps filling.
+ */
+static inline int daemon_serve(scene *world, radiance_cache *cache, const char *scene_name, const char *path,
+                               int num_threads) {
+    daemon_server d;
+    d.world = world;
+    d.cache = cache;
+    d.scene_name = scene_name;
+    atomic_init(&d.next_image, 0);
+    if (render_pool_init(&d.pool, num_threads) != 0) {
+        fprintf(stderr, "Error: Failed to start render threads\n");
+        return -1;
+    }
+
+    int listen_fd = daemon_listen(path);
+    if (listen_fd < 0) {
+        render_pool_destroy(&d.pool);
+        return -1;
+    }
+
+    /* No SA_RESTART: a signal interrupts accept so the loop can see daemon_stop */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stderr, "Serving scene '%s' on %s with %d threads.\n", scene_name, path, d.pool.num_threads);
+    while (!daemon_stop) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR)
+                fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            continue;
+        }
+        daemon_connection *conn = (daemon_connection *)malloc(sizeof(*conn));
+        pthread_t thread;
+        if (conn) {
+            conn->server = &d;
+            conn->fd = fd;
+        }
+        if (!conn || pthread_create(&thread, NULL, daemon_connection_thread, conn) != 0) {
+            fprintf(stderr, "Error: Failed to start connection thread\n");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    /* Connection threads may still be waiting on the pool, so it is left to process exit */
+    close(listen_fd);
+    unlink(path);
+    fprintf(stderr, "Daemon stopped.\n");
+    return 0;
+}
+
+/*
+ * Client side: sends one request to the daemon at `path`. On success
+ * *pixels maps the RGB24 image (rep->width x rep->height); release it with
+ * daemon_release_image.
+ */
+static inline int daemon_request_image(const char *path, const daemon_request *req, daemon_reply *rep,
+                                       unsigned char **pixels) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Failed to connect to daemon at %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    int rc = daemon_write_full(fd, req, sizeof(*req)) == 0 ? daemon_read_full(fd, rep, sizeof(*rep)) : -1;
+    close(fd);
+    if (rc != 1) {
+        fprintf(stderr, "Error: Lost connection to daemon\n");
+        return -1;
+    }
+    if (rep->status != 0) {
+        fprintf(stderr, "Error: daemon: %s\n", rep->message);
+        return -1;
+    }
+
+    size_t size = (size_t)rep->width * rep->height * 3;
+    int shm_fd = shm_open(rep->shm_name, O_RDONLY, 0);
+    shm_unlink(rep->shm_name);
+    if (shm_fd < 0) {
+        fprintf(stderr, "Error: Failed to open shared image %s\n", rep->shm_name);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map shared image %s\n", rep->shm_name);
+        return -1;
+    }
+    *pixels = (unsigned char *)map;
+    return 0;
+}
+
+static inline void daemon_release_image(const daemon_reply *rep, unsigned char *pixels) {
+    munmap(pixels, (size_t)rep->width * rep->height * 3);
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "vec3.h"
+#include "material.h"
+#include "texture.h"
+#include "scene.h"
+
+/*
+ * Scene compiler: writes a built, committed scene out as a C header that a
+ * binary can be compiled against (-DCOMPILED_SCENE='"scene_compiled.h"').
+ * The header holds
+ *  - every primitive as static const aligned arrays and the scene BVH as
+ *    static aligned arrays (bvh points at them mutably, as bvh_build fills
+ *    its own), with doubles in hex-float notation so nothing is lost;
+ *  - SCENE_USES_* macros, which drop the material and texture cases the
+ *    scene never uses from material_scatter and texture_value;
+ *  - compiled_scene_hit, with one straight-line test per plane and, for
+ *    small scenes, per primitive (no BVH), all indexing constant data.
+ * Instances are not supported: their geometry lives behind pointers.
+ */
+#define EMIT_UNROLL_MAX 32      /* bounded primitives tested without a BVH */
+
+static inline void emit_vec3(FILE *out, vec3 v) {
+    fprintf(out, "{%a, %a, %a}", v.x, v.y, v.z);
+}
+
+static inline void emit_material(FILE *out, material m) {
+    static const char *const mat_names[] = {"MAT_LAMBERTIAN", "MAT_METAL", "MAT_DIELECTRIC"};
+    static const char *const tex_names[] = {"TEXTURE_SOLID", "TEXTURE_CHECKER", "TEXTURE_PERLIN"};
+    fprintf(out, "{%s, {%s, ", mat_names[m.type], tex_names[m.tex.type]);
+    emit_vec3(out, m.tex.color1);
+    fprintf(out, ", ");
+    emit_vec3(out, m.tex.color2);
+    fprintf(out, ", %a}, %a, %a}", m.tex.scale, m.fuzz, m.ref_idx);
+}
+
+/* Marks the material and texture types `m` needs */
+static inline void emit_note_material(material m, int *mat_used, int *tex_used) {
+    mat_used[m.type] = 1;
+    if (m.type != MAT_DIELECTRIC)   /* dielectrics never read their texture */
+        tex_used[m.tex.type] = 1;
+}
+
+/* Returns 0, or -1 if the scene cannot be compiled (after printing why) */
+static inline int scene_emit_c(const scene *s, const char *scene_name, FILE *out) {
+    if (s->instances.count > 0) {
+        fprintf(stderr, "Error: --emit-c does not support instanced scenes\n");
+        return -1;
+    }
+    if (!s->committed) {
+        fprintf(stderr, "Error: --emit-c needs a committed scene\n");
+        return -1;
+    }
+
+    uint32_t np = s->planes.count, ns = s->spheres.count, nt = s->triangles.count;
+    int unrolled = ns + nt <= EMIT_UNROLL_MAX;
+    int mat_used[3] = {0}, tex_used[3] = {0};
+    for (uint32_t i = 0; i < np; i++) emit_note_material(scene_plane(s, i)->mat, mat_used, tex_used);
+    for (uint32_t i = 0; i < ns; i++) emit_note_material(scene_sphere(s, i)->mat, mat_used, tex_used);
+    for (uint32_t i = 0; i < nt; i++) emit_note_material(scene_triangle(s, i)->mat, mat_used, tex_used);
+
+    fprintf(out, "/* Generated by raytracer --emit-c from scene '%s'; do not edit. */\n", scene_name);
+    fprintf(out, "#ifndef SCENE_COMPILED_H\n#define SCENE_COMPILED_H\n\n");
+    fprintf(out, "#define SCENE_COMPILED 1\n");
+    fprintf(out, "#define COMPILED_SCENE_NAME \"%s\"\n", scene_name);
+    fprintf(out, "#define COMPILED_NUM_PRIMITIVES %u\n\n", np + ns + nt);
+    fprintf(out, "/* Material and texture code the scene needs; the rest is compiled out */\n");
+    fprintf(out, "#define SCENE_USES_LAMBERTIAN %d\n", mat_used[MAT_LAMBERTIAN]);
+    fprintf(out, "#define SCENE_USES_METAL %d\n", mat_used[MAT_METAL]);
+    fprintf(out, "#define SCENE_USES_DIELECTRIC %d\n", mat_used[MAT_DIELECTRIC]);
+    fprintf(out, "#define SCENE_USES_CHECKER %d\n", tex_used[TEXTURE_CHECKER]);
+    fprintf(out, "#define SCENE_USES_PERLIN %d\n\n", tex_used[TEXTURE_PERLIN]);
+    fprintf(out, "#include \"sphere.h\"\n#include \"plane.h\"\n#include \"triangle.h\"\n#include \"bvh.h\"\n\n");
+
+    if (np > 0) {
+        fprintf(out, "_Alignas(64) static const plane compiled_planes[%u] = {\n", np);
+        for (uint32_t i = 0; i < np; i++) {
+            const plane *p = scene_plane(s, i);
+            fprintf(out, "    {");
+            emit_vec3(out, p->point);
+            fprintf(out, ", ");
+            emit_vec3(out, p->normal);
+            fprintf(out, ", ");
+            emit_material(out, p->mat);
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+    if (ns > 0) {
+        fprintf(out, "_Alignas(64) static const sphere compiled_spheres[%u] = {\n", ns);
+        for (uint32_t i = 0; i < ns; i++) {
+            const sphere *sp = scene_sphere(s, i);
+            fprintf(out, "    {");
+            emit_vec3(out, sp->center);
+            fprintf(out, ", %a, ", sp->radius);
+            emit_material(out, sp->mat);
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+    if (nt > 0) {
+        fprintf(out, "_Alignas(64) static const triangle compiled_triangles[%u] = {\n", nt);
+        for (uint32_t i = 0; i < nt; i++) {
+            const triangle *tri = scene_triangle(s, i);
+            fprintf(out, "    {");
+            emit_vec3(out, tri->v0);
+            fprintf(out, ", ");
+            emit_vec3(out, tri->v1);
+            fprintf(out, ", ");
+            emit_vec3(out, tri->v2);
+            fprintf(out, ", ");
+            emit_material(out, tri->mat);
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (!unrolled) {
+        const bvh *b = &s->accel;
+        fprintf(out, "_Alignas(64) static bvh_node compiled_nodes[%d] = {\n", b->num_nodes);
+        for (int i = 0; i < b->num_nodes; i++) {
+            const bvh_node *n = &b->nodes[i];
+            fprintf(out, "    {{");
+            emit_vec3(out, n->box.min);
+            fprintf(out, ", ");
+            emit_vec3(out, n->box.max);
+            fprintf(out, "}, %d, %d, %d},\n", n->start, n->count, n->right);
+        }
+        fprintf(out, "};\n\n");
+        fprintf(out, "static int compiled_prims[%d] = {", b->num_prims);
+        for (int i = 0; i < b->num_prims; i++)
+            fprintf(out, "%s%d,", i % 16 ? " " : "\n    ", b->prims[i]);
+        fprintf(out, "\n};\n\n");
+
+        /* Spheres come first in the BVH's numbering, then triangles */
+        fprintf(out, "static inline int compiled_prim_hit(const void *ctx, int prim, ray r, double t_min, double t_max,\n"
+                     "                                    hit_record *rec) {\n    (void)ctx;\n");
+        if (ns > 0 && nt > 0)
+            fprintf(out, "    if (prim < %u)\n        return sphere_hit(compiled_spheres[prim], r, t_min, t_max, rec);\n"
+                         "    return triangle_hit(compiled_triangles[prim - %u], r, t_min, t_max, rec);\n", ns, ns);
+        else if (ns > 0)
+            fprintf(out, "    return sphere_hit(compiled_spheres[prim], r, t_min, t_max, rec);\n");
+        else
+            fprintf(out, "    return triangle_hit(compiled_triangles[prim], r, t_min, t_max, rec);\n");
+        fprintf(out, "}\n\n");
+        fprintf(out, "static const bvh compiled_bvh = {compiled_nodes, %d, compiled_prims, %d};\n\n",
+                b->num_nodes, b->num_prims);
+    }
+
+    /* Closest hit; the hit functions only write rec on a hit closer than t_max */
+    fprintf(out, "static inline int compiled_scene_hit(ray r, double t_min, double t_max, hit_record *rec) {\n");
+    fprintf(out, "    int hit_anything = 0;\n    double closest = t_max;\n");
+    for (uint32_t i = 0; i < np; i++)
+        fprintf(out, "    if (plane_hit(compiled_planes[%u], r, t_min, closest, rec)) { hit_anything = 1; closest = rec->t; }\n", i);
+    if (unrolled) {
+        for (uint32_t i = 0; i < ns; i++)
+            fprintf(out, "    if (sphere_hit(compiled_spheres[%u], r, t_min, closest, rec)) { hit_anything = 1; closest = rec->t; }\n", i);
+        for (uint32_t i = 0; i < nt; i++)
+            fprintf(out, "    if (triangle_hit(compiled_triangles[%u], r, t_min, closest, rec)) { hit_anything = 1; closest = rec->t; }\n", i);
+    } else {
+        fprintf(out, "    if (bvh_hit(&compiled_bvh, r, t_min, closest, rec, compiled_prim_hit, NULL))\n        hit_anything = 1;\n");
+    }
+    fprintf(out, "    return hit_anything;\n}\n\n#endif\n");
+    return ferror(out) ? -1 : 0;
+}
+
+#endif
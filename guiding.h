@@ -0,0 +1,174 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+
+#include "vec3.h"
+#include "radcache.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Path guiding for diffuse scattering. Space is split into a uniform grid of
+ * cells (hashed like the radiance cache); each cell learns a histogram of
+ * where its incoming light comes from over the sphere of directions, in
+ * equal-area bins (bands of cos(theta) by sectors of phi).
+ *
+ * During a pass, every diffuse bounce adds its incoming luminance divided by
+ * the sampling pdf to the bin it went through, with atomic fixed-point adds.
+ * Between passes guide_update turns each cell's histogram into a sampling
+ * distribution, so later passes send rays where light was found. Scattering
+ * mixes that distribution with cosine (BSDF) sampling, weighting by the
+ * mixture pdf, so the estimate stays unbiased even where the histogram is wrong.
+ */
+#define GUIDE_THETA_BINS 8
+#define GUIDE_PHI_BINS 16
+#define GUIDE_BINS (GUIDE_THETA_BINS * GUIDE_PHI_BINS)
+#define GUIDE_ENTRIES 16384         /* cells held; others scatter without guidance */
+#define GUIDE_MAX_PROBES 16
+#define GUIDE_MIN_SAMPLES 64        /* samples a cell needs before it guides */
+#define GUIDE_FRACTION 0.5          /* share of guided directions where a cell can guide */
+#define GUIDE_UNIFORM 0.1           /* learned pdf mass spread evenly, so no direction gets pdf 0 */
+#define GUIDE_FIXED_ONE 65536.0
+#define GUIDE_MAX_VALUE 4096.0      /* clamp on one sample's contribution, against fireflies in training */
+
+typedef struct {
+    atomic_uint_least64_t key;      /* 0: empty */
+    atomic_uint count;              /* samples recorded */
+    atomic_uint_least64_t train[GUIDE_BINS];
+    int ready;                      /* `cdf` holds a distribution */
+    float cdf[GUIDE_BINS];          /* cumulative, cdf[GUIDE_BINS - 1] == 1 */
+} guide_cell;
+
+typedef struct {
+    guide_cell *cells;
+    uint64_t mask;
+    double inv_cell;
+} path_guide;
+
+static inline int guide_create(path_guide *g, double cell_size) {
+    g->cells = (guide_cell *)calloc(GUIDE_ENTRIES, sizeof(guide_cell));
+    g->mask = GUIDE_ENTRIES - 1;
+    g->inv_cell = 1.0 / cell_size;
+    return g->cells ? 0 : -1;
+}
+
+static inline void guide_free(path_guide *g) {
+    free(g->cells);
+    g->cells = NULL;
+}
+
+/* Forgets everything learned, e.g. between animation frames; not safe during a render */
+static inline void guide_clear(path_guide *g) {
+    memset(g->cells, 0, sizeof(guide_cell) * GUIDE_ENTRIES);
+}
+
+/* Cell containing p, created if needed; NULL if its region of the table is full */
+static inline guide_cell *guide_cell_at(path_guide *g, vec3 p) {
+    uint64_t key = radcache_cell(p.x, g->inv_cell);
+    key = (key << RADCACHE_CELL_BITS) | radcache_cell(p.y, g->inv_cell);
+    key = (key << RADCACHE_CELL_BITS) | radcache_cell(p.z, g->inv_cell);
+    key |= 1ull << 63;
+    uint64_t slot = radcache_hash(key);
+    for (int probe = 0; probe < GUIDE_MAX_PROBES; probe++, slot++) {
+        guide_cell *c = &g->cells[slot & g->mask];
+        uint64_t found = atomic_load_explicit(&c->key, memory_order_relaxed);
+        if (found == key)
+            return c;
+        if (found == 0) {
+            uint_least64_t expected = 0;
+            if (atomic_compare_exchange_strong(&c->key, &expected, key) || expected == key)
+                return c;
+        }
+    }
+    return NULL;
+}
+
+/* Equal-area bin of a unit direction: cos(theta) is d.y, phi is measured in the xz plane */
+static inline int guide_bin(vec3 d) {
+    int t = (int)((d.y * 0.5 + 0.5) * GUIDE_THETA_BINS);
+    int p = (int)((atan2(d.z, d.x) / (2.0 * M_PI) + 0.5) * GUIDE_PHI_BINS);
+    t = t < 0 ? 0 : (t >= GUIDE_THETA_BINS ? GUIDE_THETA_BINS - 1 : t);
+    p = p < 0 ? 0 : (p >= GUIDE_PHI_BINS ? GUIDE_PHI_BINS - 1 : p);
+    return t * GUIDE_PHI_BINS + p;
+}
+
+/* Learned solid-angle pdf of direction d in a ready cell */
+static inline double guide_pdf(const guide_cell *c, vec3 d) {
+    int b = guide_bin(d);
+    double mass = c->cdf[b] - (b > 0 ? c->cdf[b - 1] : 0.0f);
+    return mass * GUIDE_BINS / (4.0 * M_PI);
+}
+
+/* Direction drawn from a ready cell's distribution */
+static inline vec3 guide_sample(const guide_cell *c) {
+    double u = random_double();
+    int lo = 0, hi = GUIDE_BINS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (c->cdf[mid] <= u) lo = mid + 1;
+        else hi = mid;
+    }
+    int t = lo / GUIDE_PHI_BINS, p = lo % GUIDE_PHI_BINS;
+    double y = -1.0 + (t + random_double()) * (2.0 / GUIDE_THETA_BINS);
+    double phi = -M_PI + (p + random_double()) * (2.0 * M_PI / GUIDE_PHI_BINS);
+    double r = sqrt(fmax(0.0, 1.0 - y * y));
+    return vec3_create(r * cos(phi), y, r * sin(phi));
+}
+
+/*
+ * Diffuse scatter direction at a surface with unit `normal` in cell `c` (may
+ * be NULL). Returns the direction and its pdf under the mixture actually used.
+ */
+static inline vec3 guide_scatter(const guide_cell *c, vec3 normal, double *pdf) {
+    int guided = c && c->ready;
+    vec3 dir;
+    if (guided && random_double() < GUIDE_FRACTION) {
+        dir = guide_sample(c);
+    } else {
+        dir = vec3_add(normal, random_unit_vector());
+        dir = vec3_near_zero(dir) ? normal : vec3_unit(dir);
+    }
+    double cos_pdf = fmax(vec3_dot(dir, normal), 0.0) / M_PI;
+    *pdf = guided ? GUIDE_FRACTION * guide_pdf(c, dir) + (1.0 - GUIDE_FRACTION) * cos_pdf : cos_pdf;
+    return dir;
+}
+
+/* Records `radiance` arriving along `dir`, a direction sampled with density `pdf` */
+static inline void guide_record(guide_cell *c, vec3 dir, vec3 radiance, double pdf) {
+    double lum = 0.2126 * radiance.x + 0.7152 * radiance.y + 0.0722 * radiance.z;
+    double v = fmin(fmax(lum, 0.0) / pdf, GUIDE_MAX_VALUE);
+    atomic_fetch_add_explicit(&c->train[guide_bin(dir)], (uint64_t)(v * GUIDE_FIXED_ONE), memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->count, 1, memory_order_relaxed);
+}
+
+/*
+ * Rebuilds sampling distributions from everything recorded so far. Call
+ * between passes, while no render thread is running.
+ */
+static inline void guide_update(path_guide *g) {
+    for (uint64_t i = 0; i <= g->mask; i++) {
+        guide_cell *c = &g->cells[i];
+        if (atomic_load(&c->key) == 0 || atomic_load(&c->count) < GUIDE_MIN_SAMPLES)
+            continue;
+        double total = 0.0;
+        for (int b = 0; b < GUIDE_BINS; b++)
+            total += (double)atomic_load(&c->train[b]);
+        if (total <= 0.0)
+            continue;
+        double acc = 0.0;
+        for (int b = 0; b < GUIDE_BINS; b++) {
+            acc += (1.0 - GUIDE_UNIFORM) * (double)atomic_load(&c->train[b]) / total + GUIDE_UNIFORM / GUIDE_BINS;
+            c->cdf[b] = (float)acc;
+        }
+        c->cdf[GUIDE_BINS - 1] = 1.0f;
+        c->ready = 1;
+    }
+}
+
+#endif
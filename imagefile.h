@@ -0,0 +1,354 @@
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "color.h"
+
+/*
+ * Image files written top to bottom in pieces, so a frame never has to be
+ * held in memory whole: plain PPM (as write_ppm), or PNG with the pixel data
+ * in stored (uncompressed) deflate blocks, which need no compression library.
+ *
+ * image_writer writes synchronously. image_stream runs one on a writer
+ * thread with two band slots, so the renderer fills one slot while the
+ * other is being written, as video.h does for whole frames.
+ */
+typedef enum {
+    IMAGE_PPM,
+    IMAGE_PNG
+} image_format;
+
+#define IMAGE_SLOTS 2
+#define IMAGE_DEFLATE_BLOCK 65535   /* largest stored deflate block */
+#define IMAGE_ADLER_RUN 5552        /* bytes the Adler-32 sums take before they must be reduced */
+
+typedef struct {
+    FILE *out;
+    image_format format;
+    int width, height;
+    int rows_written;
+
+    /* PNG: the zlib stream spans every IDAT chunk; one chunk per call to image_writer_rows */
+    uint64_t raw_left;              /* filtered scanline bytes not yet written */
+    uint32_t block_left;            /* bytes left in the current stored block */
+    uint32_t adler_a, adler_b;
+    unsigned char *chunk;           /* IDAT payload being assembled */
+    size_t chunk_len, chunk_cap;
+} image_writer;
+
+/* PNG for paths ending in ".png", PPM otherwise */
+static inline image_format image_format_for(const char *path) {
+    size_t n = path ? strlen(path) : 0;
+    return n >= 4 && !strcmp(path + n - 4, ".png") ? IMAGE_PNG : IMAGE_PPM;
+}
+
+static inline uint32_t image_crc32_update(uint32_t crc, const unsigned char *p, size_t n) {
+    static uint32_t table[256];
+    static int table_ready;
+    if (!table_ready) {         /* built on first use */
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static inline void image_put_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+/* Writes one PNG chunk; returns 0 or -1 */
+static inline int image_png_chunk(FILE *out, const char *type, const unsigned char *data, size_t len) {
+    unsigned char head[8], tail[4];
+    image_put_be32(head, (uint32_t)len);
+    memcpy(head + 4, type, 4);
+    uint32_t crc = image_crc32_update(0xFFFFFFFFu, head + 4, 4);
+    crc = image_crc32_update(crc, data, len) ^ 0xFFFFFFFFu;
+    image_put_be32(tail, crc);
+    return fwrite(head, 1, 8, out) == 8 && (len == 0 || fwrite(data, 1, len, out) == len)
+           && fwrite(tail, 1, 4, out) == 4 ? 0 : -1;
+}
+
+/* Appends zlib payload bytes to the chunk, opening stored blocks as they fill */
+static inline void image_png_put(image_writer *w, const unsigned char *p, size_t n) {
+    while (n > 0) {
+        if (w->block_left == 0) {
+            uint32_t len = w->raw_left < IMAGE_DEFLATE_BLOCK ? (uint32_t)w->raw_left : IMAGE_DEFLATE_BLOCK;
+            unsigned char *h = w->chunk + w->chunk_len;
+            h[0] = len == w->raw_left;  /* BFINAL on the last block, BTYPE 00 (stored) */
+            h[1] = (unsigned char)len;
+            h[2] = (unsigned char)(len >> 8);
+            h[3] = (unsigned char)~len;
+            h[4] = (unsigned char)(~len >> 8);
+            w->chunk_len += 5;
+            w->block_left = len;
+        }
+        size_t k = n < w->block_left ? n : w->block_left;
+        memcpy(w->chunk + w->chunk_len, p, k);
+        for (size_t done = 0; done < k; ) {
+            size_t m = k - done < IMAGE_ADLER_RUN ? k - done : IMAGE_ADLER_RUN;
+            for (size_t i = done; i < done + m; i++) {
+                w->adler_a += p[i];
+                w->adler_b += w->adler_a;
+            }
+            w->adler_a %= 65521u;
+            w->adler_b %= 65521u;
+            done += m;
+        }
+        w->chunk_len += k;
+        w->block_left -= (uint32_t)k;
+        w->raw_left -= k;
+        p += k;
+        n -= k;
+    }
+}
+
+/* Room for `rows` filtered scanlines plus block headers, the zlib header and its checksum */
+static inline int image_png_reserve(image_writer *w, int rows) {
+    size_t raw = (size_t)rows * (1 + (size_t)w->width * 3);
+    size_t need = raw + 5 * (raw / IMAGE_DEFLATE_BLOCK + 2) + 2 + 4;
+    if (need <= w->chunk_cap)
+        return 0;
+    unsigned char *chunk = (unsigned char *)realloc(w->chunk, need);
+    if (!chunk)
+        return -1;
+    w->chunk = chunk;
+    w->chunk_cap = need;
+    return 0;
+}
+
+/* Writes the file header; returns 0, or -1 on a write error */
+static inline int image_writer_begin(image_writer *w, FILE *out, image_format format, int width, int height) {
+    memset(w, 0, sizeof(*w));
+    w->out = out;
+    w->format = format;
+    w->width = width;
+    w->height = height;
+    if (format == IMAGE_PPM)
+        return fprintf(out, "P3\n%d %d\n255\n", width, height) < 0 ? -1 : 0;
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    unsigned char ihdr[13];
+    image_put_be32(ihdr, (uint32_t)width);
+    image_put_be32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8;        /* bits per channel */
+    ihdr[9] = 2;        /* RGB */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;     /* deflate, adaptive filtering, no interlace */
+    w->raw_left = (uint64_t)height * (1 + (uint64_t)width * 3);
+    w->adler_a = 1;
+    if (fwrite(signature, 1, 8, out) != 8 || image_png_chunk(out, "IHDR", ihdr, sizeof(ihdr)) != 0)
+        return -1;
+    return 0;
+}
+
+/* Writes the next `rows` rows of RGB24 pixels; returns 0, or -1 on an allocation or write error */
+static inline int image_writer_rows(image_writer *w, const unsigned char *rgb, int rows) {
+    if (rows > w->height - w->rows_written)
+        return -1;
+    if (w->format == IMAGE_PPM) {
+        write_ppm_rows(w->out, rgb, w->width, rows);
+        w->rows_written += rows;
+        return ferror(w->out) ? -1 : 0;
+    }
+
+    if (image_png_reserve(w, rows) != 0)
+        return -1;
+    w->chunk_len = 0;
+    if (w->rows_written == 0) {
+        w->chunk[0] = 0x78;     /* zlib: deflate, 32K window, no preset dictionary */
+        w->chunk[1] = 0x01;
+        w->chunk_len = 2;
+    }
+    static const unsigned char filter_none = 0;
+    for (int j = 0; j < rows; j++) {
+        image_png_put(w, &filter_none, 1);
+        image_png_put(w, rgb + (size_t)j * w->width * 3, (size_t)w->width * 3);
+    }
+    w->rows_written += rows;
+    if (w->rows_written == w->height) {
+        image_put_be32(w->chunk + w->chunk_len, (w->adler_b << 16) | w->adler_a);
+        w->chunk_len += 4;
+    }
+    return image_png_chunk(w->out, "IDAT", w->chunk, w->chunk_len);
+}
+
+/* Writes the trailer and frees the writer; returns -1 if rows are missing or a write failed */
+static inline int image_writer_end(image_writer *w) {
+    int rc = w->rows_written == w->height ? 0 : -1;
+    if (rc == 0 && w->format == IMAGE_PNG)
+        rc = image_png_chunk(w->out, "IEND", NULL, 0);
+    if (fflush(w->out) != 0 || ferror(w->out))
+        rc = -1;
+    free(w->chunk);
+    w->chunk = NULL;
+    return rc;
+}
+
+/*
+ * Writes a whole RGB24 image to `path` in the format its name asks for, or as
+ * PPM to stdout if path is NULL. Files are written under a temporary name and
+ * renamed, so a viewer never sees a half-written image. Returns 0, or -1
+ * after printing why.
+ */
+static inline int image_write_file(const unsigned char *pixels, const char *path, int width, int height) {
+    char tmp_path[512];
+    FILE *f = stdout;
+    if (path) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+        f = fopen(tmp_path, "wb");
+        if (!f) {
+            fprintf(stderr, "Error: Failed to open %s\n", tmp_path);
+            return -1;
+        }
+    }
+    image_writer writer;
+    int ok = image_writer_begin(&writer, f, image_format_for(path), width, height) == 0
+          && image_writer_rows(&writer, pixels, height) == 0;
+    if (image_writer_end(&writer) != 0)
+        ok = 0;
+    if (path && (fclose(f) != 0 || !ok || rename(tmp_path, path) != 0))
+        ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to write %s\n", path ? path : "image to stdout");
+        return -1;
+    }
+    return 0;
+}
+
+/* A writer on its own thread, fed bands of up to band_rows rows */
+typedef struct {
+    image_writer writer;
+    int band_rows;
+
+    unsigned char *slots[IMAGE_SLOTS];  /* RGB24 bands */
+    int filled[IMAGE_SLOTS];            /* rows in a queued slot, 0: free */
+    int fill_slot;                      /* next slot handed to the renderer */
+    int write_slot;                     /* next slot the writer thread consumes */
+    int closing;
+    int error;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} image_stream;
+
+static void *image_writer_thread(void *arg) {
+    image_stream *is = (image_stream *)arg;
+    pthread_mutex_lock(&is->lock);
+    for (;;) {
+        while (!is->filled[is->write_slot] && !is->closing)
+            pthread_cond_wait(&is->cond, &is->lock);
+        if (!is->filled[is->write_slot])
+            break;  /* closing and drained */
+
+        int slot = is->write_slot;
+        int rows = is->filled[slot];
+        pthread_mutex_unlock(&is->lock);
+        int rc = is->error ? -1 : image_writer_rows(&is->writer, is->slots[slot], rows);
+        pthread_mutex_lock(&is->lock);
+
+        if (rc != 0)
+            is->error = 1;
+        is->filled[slot] = 0;
+        is->write_slot = (slot + 1) % IMAGE_SLOTS;
+        pthread_cond_broadcast(&is->cond);
+    }
+    pthread_mutex_unlock(&is->lock);
+    return NULL;
+}
+
+/* Bytes an image_stream holds besides its writer's PNG chunk (another band's worth at most) */
+static inline size_t image_stream_bytes(int width, int band_rows) {
+    return IMAGE_SLOTS * (size_t)width * band_rows * 3;
+}
+
+/* Writes the file header and starts the writer thread; returns 0, or -1 after printing why */
+static inline int image_stream_open(image_stream *is, FILE *out, image_format format, int width, int height,
+                                    int band_rows) {
+    memset(is, 0, sizeof(*is));
+    is->band_rows = band_rows;
+    for (int i = 0; i < IMAGE_SLOTS; i++)
+        is->slots[i] = (unsigned char *)malloc((size_t)width * band_rows * 3);
+    int allocated = 1;
+    for (int i = 0; i < IMAGE_SLOTS; i++)
+        allocated = allocated && is->slots[i];
+    if (!allocated) {
+        fprintf(stderr, "Error: Failed to allocate image stream buffers\n");
+        for (int i = 0; i < IMAGE_SLOTS; i++)
+            free(is->slots[i]);
+        return -1;
+    }
+    if (image_writer_begin(&is->writer, out, format, width, height) != 0) {
+        fprintf(stderr, "Error: Failed to write image header\n");
+        for (int i = 0; i < IMAGE_SLOTS; i++)
+            free(is->slots[i]);
+        return -1;
+    }
+
+    pthread_mutex_init(&is->lock, NULL);
+    pthread_cond_init(&is->cond, NULL);
+    if (pthread_create(&is->thread, NULL, image_writer_thread, is) != 0) {
+        fprintf(stderr, "Error: Failed to start image writer thread\n");
+        pthread_mutex_destroy(&is->lock);
+        pthread_cond_destroy(&is->cond);
+        for (int i = 0; i < IMAGE_SLOTS; i++)
+            free(is->slots[i]);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns a buffer for the next band, waiting while both slots are in use */
+static inline unsigned char *image_stream_acquire(image_stream *is) {
+    pthread_mutex_lock(&is->lock);
+    while (is->filled[is->fill_slot])
+        pthread_cond_wait(&is->cond, &is->lock);
+    unsigned char *buf = is->slots[is->fill_slot];
+    pthread_mutex_unlock(&is->lock);
+    return buf;
+}
+
+/* Queues `rows` rows of the buffer from image_stream_acquire; returns -1 if an earlier write failed */
+static inline int image_stream_submit(image_stream *is, int rows) {
+    pthread_mutex_lock(&is->lock);
+    is->filled[is->fill_slot] = rows;
+    is->fill_slot = (is->fill_slot + 1) % IMAGE_SLOTS;
+    int error = is->error;
+    pthread_cond_broadcast(&is->cond);
+    pthread_mutex_unlock(&is->lock);
+    return error ? -1 : 0;
+}
+
+/* Drains queued bands, stops the writer and writes the trailer; returns -1 if any write failed */
+static inline int image_stream_close(image_stream *is) {
+    pthread_mutex_lock(&is->lock);
+    is->closing = 1;
+    pthread_cond_broadcast(&is->cond);
+    pthread_mutex_unlock(&is->lock);
+    pthread_join(is->thread, NULL);
+
+    int error = is->error;
+    if (image_writer_end(&is->writer) != 0)
+        error = 1;
+    pthread_mutex_destroy(&is->lock);
+    pthread_cond_destroy(&is->cond);
+    for (int i = 0; i < IMAGE_SLOTS; i++)
+        free(is->slots[i]);
+    return error ? -1 : 0;
+}
+
+#endif
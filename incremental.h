@@ -0,0 +1,407 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vec3.h"
+#include "scene.h"
+#include "accum.h"
+
+/*
+ * Incremental re-rendering after a scene edit. While rendering, each tile
+ * records the set of primitives its camera rays and first bounces hit. The
+ * image, those sets and a content hash of every primitive are kept in a state
+ * file. On the next render the scene is hashed again and compared, primitive
+ * by primitive (ids are the kind and handle, see scene_prim_id), with the
+ * stored hashes; a tile is re-rendered if its recorded set contains a changed
+ * primitive (where an edited object used to be) or if a short, shallow probe
+ * pass over the new scene sees one there (where it is now).
+ *
+ * Tiles keep their seeds, so a re-rendered tile is exactly what a full render
+ * of the new scene would give (the radiance cache and path guiding, whose
+ * contents depend on which tiles rendered, are not allowed with incremental
+ * renders). Effects reaching a tile only through deeper bounces are missed;
+ * anything that changes every pixel (camera, sky, image size, samples, seed)
+ * is caught by a settings hash and renders everything.
+ */
+#define INCR_VERSION 2
+#define INCR_MAGIC "VTINCR"
+#define INCR_RECORD_BOUNCES 1       /* record hits of camera rays and this many bounces after them */
+#define INCR_PROBE_SAMPLES 4        /* samples per pixel of the probe pass over the edited scene */
+#define INCR_MAX_TILE_PRIMS 4096    /* a tile seeing more is re-rendered after any edit */
+#define INCR_SET_SLOTS 8192         /* power of two, twice INCR_MAX_TILE_PRIMS */
+#define INCR_OVERFLOW UINT32_MAX    /* incr_tile.count of a tile with too many primitives */
+#define INCR_EMPTY_SLOT UINT32_MAX
+
+/* Primitives seen by one tile, sorted ids */
+typedef struct {
+    uint32_t count;
+    uint32_t *ids;
+} incr_tile;
+
+/* Set a render thread collects one tile's ids in */
+typedef struct {
+    uint32_t slots[INCR_SET_SLOTS];
+    uint32_t count;
+    int overflow;
+} incr_set;
+
+static __thread incr_set tl_touched;
+
+/* Content hashes of every primitive, per kind (SCENE_PRIM_*) */
+typedef struct {
+    uint32_t count[SCENE_PRIM_KINDS];
+    uint64_t *hash[SCENE_PRIM_KINDS];
+} incr_scene;
+
+/* Which primitive ids differ between two scenes */
+typedef struct {
+    uint32_t size[SCENE_PRIM_KINDS];
+    uint8_t *changed[SCENE_PRIM_KINDS];
+    uint32_t num_changed;
+} incr_changes;
+
+/* Everything kept between renders */
+typedef struct {
+    uint64_t settings;      /* hash of the non-scene inputs */
+    uint32_t seed;
+    int num_tiles;
+    incr_scene scene;
+    incr_tile *tiles;
+    accum_buffer acc;
+} incr_state;
+
+/* On-disk header, followed by the hashes, the tile sets and the accumulation buffer; host byte order */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint64_t settings;
+    int32_t num_tiles;
+    uint32_t count[SCENE_PRIM_KINDS];
+} incr_file_header;
+
+static inline uint64_t incr_mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t incr_mix_double(uint64_t h, double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return incr_mix(h, bits);
+}
+
+static inline uint64_t incr_mix_vec3(uint64_t h, vec3 v) {
+    return incr_mix_double(incr_mix_double(incr_mix_double(h, v.x), v.y), v.z);
+}
+
+/* Field by field, so struct padding never reaches the hash */
+static inline uint64_t incr_mix_material(uint64_t h, material m) {
+    h = incr_mix(h, (uint64_t)m.type);
+    h = incr_mix(h, (uint64_t)m.tex.type);
+    h = incr_mix_vec3(h, m.tex.color1);
+    h = incr_mix_vec3(h, m.tex.color2);
+    h = incr_mix_double(h, m.tex.scale);
+    h = incr_mix_double(h, m.fuzz);
+    return incr_mix_double(h, m.ref_idx);
+}
+
+static inline uint64_t incr_hash_sphere(const sphere *s) {
+    return incr_mix_material(incr_mix_double(incr_mix_vec3(1, s->center), s->radius), s->mat);
+}
+
+static inline uint64_t incr_hash_triangle(const triangle *t) {
+    return incr_mix_material(incr_mix_vec3(incr_mix_vec3(incr_mix_vec3(2, t->v0), t->v1), t->v2), t->mat);
+}
+
+static inline uint64_t incr_hash_plane(const plane *p) {
+    return incr_mix_material(incr_mix_vec3(incr_mix_vec3(3, p->point), p->normal), p->mat);
+}
+
+static inline uint64_t incr_hash_geometry(const geometry *g) {
+    uint64_t h = 4;
+    for (int i = 0; i < g->num_spheres; i++)
+        h = incr_mix(h, incr_hash_sphere(&g->spheres[i]));
+    for (int i = 0; i < g->num_triangles; i++)
+        h = incr_mix(h, incr_hash_triangle(&g->triangles[i]));
+    return h;
+}
+
+/* `geom_hash` is the hash of inst->geom */
+static inline uint64_t incr_hash_instance(const instance *inst, uint64_t geom_hash) {
+    uint64_t h = incr_mix(5, geom_hash);
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            h = incr_mix_double(h, inst->xf.m[r][c]);
+    h = incr_mix(h, (uint64_t)inst->override_material);
+    return inst->override_material ? incr_mix_material(h, inst->mat) : h;
+}
+
+static inline void incr_scene_free(incr_scene *s) {
+    for (int k = 0; k < SCENE_PRIM_KINDS; k++) {
+        free(s->hash[k]);
+        s->hash[k] = NULL;
+        s->count[k] = 0;
+    }
+}
+
+/* Hashes every primitive of `world`; returns 0, or -1 if out of memory */
+static inline int incr_scene_hash(const scene *world, incr_scene *out) {
+    out->count[SCENE_PRIM_SPHERE] = world->spheres.count;
+    out->count[SCENE_PRIM_TRIANGLE] = world->triangles.count;
+    out->count[SCENE_PRIM_INSTANCE] = world->instances.count;
+    out->count[SCENE_PRIM_PLANE] = world->planes.count;
+    for (int k = 0; k < SCENE_PRIM_KINDS; k++) {
+        out->hash[k] = (uint64_t *)malloc(sizeof(uint64_t) * (out->count[k] ? out->count[k] : 1));
+        if (!out->hash[k]) {
+            incr_scene_free(out);
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < world->spheres.count; i++)
+        out->hash[SCENE_PRIM_SPHERE][i] = incr_hash_sphere(scene_sphere(world, i));
+    for (uint32_t i = 0; i < world->triangles.count; i++)
+        out->hash[SCENE_PRIM_TRIANGLE][i] = incr_hash_triangle(scene_triangle(world, i));
+    for (uint32_t i = 0; i < world->planes.count; i++)
+        out->hash[SCENE_PRIM_PLANE][i] = incr_hash_plane(scene_plane(world, i));
+
+    /* Instances usually share a few blocks; hash each run of the same block once */
+    const geometry *last = NULL;
+    uint64_t geom_hash = 0;
+    for (uint32_t i = 0; i < world->instances.count; i++) {
+        const instance *inst = scene_instance(world, i);
+        if (inst->geom != last) {
+            last = inst->geom;
+            geom_hash = incr_hash_geometry(last);
+        }
+        out->hash[SCENE_PRIM_INSTANCE][i] = incr_hash_instance(inst, geom_hash);
+    }
+    return 0;
+}
+
+static inline void incr_changes_free(incr_changes *c) {
+    for (int k = 0; k < SCENE_PRIM_KINDS; k++) {
+        free(c->changed[k]);
+        c->changed[k] = NULL;
+    }
+}
+
+/*
+ * Marks the ids whose primitive differs between `old` and `cur`, including
+ * ids that exist in only one of them. Returns 0, or -1 if out of memory.
+ */
+static inline int incr_diff(const incr_scene *old, const incr_scene *cur, incr_changes *out) {
+    out->num_changed = 0;
+    for (int k = 0; k < SCENE_PRIM_KINDS; k++) {
+        uint32_t n = old->count[k] > cur->count[k] ? old->count[k] : cur->count[k];
+        out->size[k] = n;
+        out->changed[k] = (uint8_t *)calloc(n ? n : 1, 1);
+        if (!out->changed[k]) {
+            incr_changes_free(out);
+            return -1;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            int changed = i >= old->count[k] || i >= cur->count[k] || old->hash[k][i] != cur->hash[k][i];
+            out->changed[k][i] = (uint8_t)changed;
+            out->num_changed += (uint32_t)changed;
+        }
+    }
+    return 0;
+}
+
+static inline int incr_prim_changed(const incr_changes *c, uint32_t id) {
+    uint32_t kind = id >> SCENE_PRIM_KIND_SHIFT, i = id & SCENE_PRIM_INDEX_MASK;
+    return i >= c->size[kind] || c->changed[kind][i];
+}
+
+/* Whether tile `t` may look different after the changes */
+static inline int incr_tile_dirty(const incr_tile *t, const incr_changes *c) {
+    if (t->count == INCR_OVERFLOW)
+        return 1;
+    for (uint32_t i = 0; i < t->count; i++)
+        if (incr_prim_changed(c, t->ids[i]))
+            return 1;
+    return 0;
+}
+
+static inline void incr_tiles_free(incr_tile *tiles, int num_tiles) {
+    if (!tiles)
+        return;
+    for (int t = 0; t < num_tiles; t++)
+        free(tiles[t].ids);
+    free(tiles);
+}
+
+/* Starts collecting a tile's ids, on top of those it already has */
+static inline void incr_set_begin(incr_set *s, const incr_tile *t) {
+    memset(s->slots, 0xFF, sizeof(s->slots));
+    s->count = 0;
+    s->overflow = t->count == INCR_OVERFLOW;
+    for (uint32_t i = 0; !s->overflow && i < t->count; i++) {
+        uint32_t slot = (t->ids[i] * 0x9E3779B1u) & (INCR_SET_SLOTS - 1);
+        while (s->slots[slot] != INCR_EMPTY_SLOT)
+            slot = (slot + 1) & (INCR_SET_SLOTS - 1);
+        s->slots[slot] = t->ids[i];
+        s->count++;
+    }
+}
+
+/* Notes a hit on primitive `id` */
+static inline void incr_set_add(incr_set *s, uint32_t id) {
+    if (s->overflow)
+        return;
+    uint32_t slot = (id * 0x9E3779B1u) & (INCR_SET_SLOTS - 1);
+    while (s->slots[slot] != INCR_EMPTY_SLOT && s->slots[slot] != id)
+        slot = (slot + 1) & (INCR_SET_SLOTS - 1);
+    if (s->slots[slot] == INCR_EMPTY_SLOT) {
+        if (s->count == INCR_MAX_TILE_PRIMS) {
+            s->overflow = 1;
+            return;
+        }
+        s->slots[slot] = id;
+        s->count++;
+    }
+}
+
+static inline int incr_compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Replaces the tile's ids with those collected; out of memory counts as overflow */
+static inline void incr_set_end(incr_set *s, incr_tile *t) {
+    free(t->ids);
+    t->ids = NULL;
+    t->count = INCR_OVERFLOW;
+    if (s->overflow)
+        return;
+    t->ids = (uint32_t *)malloc(sizeof(uint32_t) * (s->count ? s->count : 1));
+    if (!t->ids)
+        return;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < INCR_SET_SLOTS; i++)
+        if (s->slots[i] != INCR_EMPTY_SLOT)
+            t->ids[n++] = s->slots[i];
+    qsort(t->ids, n, sizeof(uint32_t), incr_compare_ids);
+    t->count = n;
+}
+
+static inline void incr_state_free(incr_state *st) {
+    incr_scene_free(&st->scene);
+    incr_tiles_free(st->tiles, st->num_tiles);
+    st->tiles = NULL;
+    accum_free(&st->acc);
+}
+
+/* Writes the state to `path` through a temporary file, so a crash never leaves it half written */
+static inline int incr_save(const incr_state *st, const char *path) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Failed to open %s\n", tmp_path);
+        return -1;
+    }
+
+    incr_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INCR_MAGIC, sizeof(INCR_MAGIC));
+    h.version = INCR_VERSION;
+    h.seed = st->seed;
+    h.settings = st->settings;
+    h.num_tiles = st->num_tiles;
+    memcpy(h.count, st->scene.count, sizeof(h.count));
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int k = 0; ok && k < SCENE_PRIM_KINDS; k++)
+        ok = fwrite(st->scene.hash[k], sizeof(uint64_t), h.count[k], f) == h.count[k];
+    for (int t = 0; ok && t < st->num_tiles; t++) {
+        const incr_tile *tile = &st->tiles[t];
+        ok = fwrite(&tile->count, sizeof(uint32_t), 1, f) == 1
+          && (tile->count == INCR_OVERFLOW || fwrite(tile->ids, sizeof(uint32_t), tile->count, f) == tile->count);
+    }
+    ok = ok && accum_write(&st->acc, f) == 0;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Loads a state saved by incr_save into `st` (zero-initialised). Returns 0,
+ * 1 if there is no such file, or -1 if it cannot be used (after saying why).
+ */
+static inline int incr_load(incr_state *st, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        if (errno == ENOENT)
+            return 1;
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        return -1;
+    }
+
+    incr_file_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, INCR_MAGIC, sizeof(INCR_MAGIC)) != 0
+        || h.version != INCR_VERSION || h.num_tiles <= 0) {
+        fprintf(stderr, "Error: %s is not an incremental render state\n", path);
+        fclose(f);
+        return -1;
+    }
+    st->settings = h.settings;
+    st->seed = h.seed;
+    st->num_tiles = h.num_tiles;
+
+    /* Check the counts against what the file holds before allocating for them */
+    long start = ftell(f);
+    int ok = start >= 0 && fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = ok && size >= start && fseek(f, start, SEEK_SET) == 0;
+    uint64_t need = (uint64_t)h.num_tiles * sizeof(uint32_t);
+    for (int k = 0; k < SCENE_PRIM_KINDS; k++) {
+        if (h.count[k] > SCENE_PRIM_INDEX_MASK + 1u)
+            ok = 0;
+        need += (uint64_t)h.count[k] * sizeof(uint64_t);
+    }
+    ok = ok && need <= (uint64_t)(size - start);
+
+    for (int k = 0; ok && k < SCENE_PRIM_KINDS; k++) {
+        st->scene.count[k] = h.count[k];
+        st->scene.hash[k] = (uint64_t *)malloc(sizeof(uint64_t) * (h.count[k] ? h.count[k] : 1));
+        ok = st->scene.hash[k] && fread(st->scene.hash[k], sizeof(uint64_t), h.count[k], f) == h.count[k];
+    }
+    if (ok)
+        ok = (st->tiles = (incr_tile *)calloc((size_t)h.num_tiles, sizeof(incr_tile))) != NULL;
+    for (int t = 0; ok && t < h.num_tiles; t++) {
+        incr_tile *tile = &st->tiles[t];
+        ok = fread(&tile->count, sizeof(uint32_t), 1, f) == 1
+          && (tile->count == INCR_OVERFLOW || tile->count <= INCR_MAX_TILE_PRIMS);
+        if (!ok || tile->count == INCR_OVERFLOW)
+            continue;
+        tile->ids = (uint32_t *)malloc(sizeof(uint32_t) * (tile->count ? tile->count : 1));
+        ok = tile->ids && fread(tile->ids, sizeof(uint32_t), tile->count, f) == tile->count;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: %s is truncated or corrupt\n", path);
+        fclose(f);
+        incr_state_free(st);
+        return -1;
+    }
+    int rc = accum_read(&st->acc, f, path);
+    fclose(f);
+    if (rc != 0) {
+        incr_state_free(st);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
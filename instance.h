@@ -0,0 +1,163 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <stdlib.h>
+
+#include "vec3.h"
+#include "ray.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "transform.h"
+
+/*
+ * A geometry block is a reusable set of spheres and triangles in its own
+ * object space, with a BVH over them. Instances place a block in the world
+ * through a transform and may override its materials; any number of
+ * instances share one block, so a repeated asset is stored only once.
+ */
+typedef struct {
+    sphere *spheres;
+    int num_spheres, cap_spheres;
+    triangle *triangles;
+    int num_triangles, cap_triangles;
+    bvh accel;          /* over spheres first, then triangles */
+    aabb bounds;        /* object space */
+} geometry;
+
+typedef struct {
+    const geometry *geom;
+    transform xf;           /* object to world */
+    aabb world_bounds;
+    int override_material;  /* nonzero: use `mat` instead of the block's materials */
+    material mat;
+} instance;
+
+static inline void geometry_init(geometry *g) {
+    g->spheres = NULL;
+    g->num_spheres = g->cap_spheres = 0;
+    g->triangles = NULL;
+    g->num_triangles = g->cap_triangles = 0;
+    g->accel = (bvh){NULL, 0, NULL, 0};
+    g->bounds = aabb_empty();
+}
+
+static inline void geometry_free(geometry *g) {
+    free(g->spheres);
+    free(g->triangles);
+    bvh_free(&g->accel);
+    geometry_init(g);
+}
+
+/* Returns 0 on success, -1 if out of memory */
+static inline int geometry_add_sphere(geometry *g, sphere sp) {
+    if (g->num_spheres == g->cap_spheres) {
+        int cap = g->cap_spheres ? g->cap_spheres * 2 : 64;
+        sphere *grown = (sphere *)realloc(g->spheres, sizeof(sphere) * (size_t)cap);
+        if (!grown) return -1;
+        g->spheres = grown;
+        g->cap_spheres = cap;
+    }
+    g->spheres[g->num_spheres++] = sp;
+    return 0;
+}
+
+static inline int geometry_add_triangle(geometry *g, triangle tri) {
+    if (g->num_triangles == g->cap_triangles) {
+        int cap = g->cap_triangles ? g->cap_triangles * 2 : 64;
+        triangle *grown = (triangle *)realloc(g->triangles, sizeof(triangle) * (size_t)cap);
+        if (!grown) return -1;
+        g->triangles = grown;
+        g->cap_triangles = cap;
+    }
+    g->triangles[g->num_triangles++] = tri;
+    return 0;
+}
+
+static inline aabb sphere_bounds(sphere s) {
+    vec3 r = vec3_create(fabs(s.radius), fabs(s.radius), fabs(s.radius));
+    return aabb_create(vec3_sub(s.center, r), vec3_add(s.center, r));
+}
+
+static inline aabb triangle_bounds(triangle t) {
+    return aabb_extend(aabb_extend(aabb_extend(aabb_empty(), t.v0), t.v1), t.v2);
+}
+
+/* Builds the block's BVH; call after the last add and before instancing it */
+static inline int geometry_commit(geometry *g) {
+    int n = g->num_spheres + g->num_triangles;
+    aabb *boxes = (aabb *)malloc(sizeof(aabb) * (size_t)(n ? n : 1));
+    if (!boxes) return -1;
+
+    g->bounds = aabb_empty();
+    for (int i = 0; i < g->num_spheres; i++)
+        boxes[i] = sphere_bounds(g->spheres[i]);
+    for (int i = 0; i < g->num_triangles; i++)
+        boxes[g->num_spheres + i] = triangle_bounds(g->triangles[i]);
+    for (int i = 0; i < n; i++)
+        g->bounds = surrounding_box(g->bounds, boxes[i]);
+
+    bvh_free(&g->accel);
+    int rc = bvh_build(&g->accel, boxes, n);
+    free(boxes);
+    return rc;
+}
+
+static inline int geometry_prim_hit(const void *ctx, int prim, ray r, double t_min, double t_max, hit_record *rec) {
+    const geometry *g = (const geometry *)ctx;
+    if (prim < g->num_spheres)
+        return sphere_hit(g->spheres[prim], r, t_min, t_max, rec);
+    return triangle_hit(g->triangles[prim - g->num_spheres], r, t_min, t_max, rec);
+}
+
+static inline int geometry_hit(const geometry *g, ray r, double t_min, double t_max, hit_record *rec) {
+    return bvh_hit(&g->accel, r, t_min, t_max, rec, geometry_prim_hit, g);
+}
+
+/* World-space box around a transformed object-space box (its eight corners) */
+static inline aabb aabb_transform(aabb box, const transform *t) {
+    aabb out = aabb_empty();
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = vec3_create(
+            (i & 1) ? box.max.x : box.min.x,
+            (i & 2) ? box.max.y : box.min.y,
+            (i & 4) ? box.max.z : box.min.z);
+        out = aabb_extend(out, transform_apply_point(t->m, corner));
+    }
+    return out;
+}
+
+static inline instance instance_create(const geometry *g, transform xf) {
+    instance inst;
+    inst.geom = g;
+    inst.xf = xf;
+    inst.world_bounds = aabb_transform(g->bounds, &inst.xf);
+    inst.override_material = 0;
+    inst.mat = mat_lambertian(vec3_create(0, 0, 0));
+    return inst;
+}
+
+static inline instance instance_create_mat(const geometry *g, transform xf, material mat) {
+    instance inst = instance_create(g, xf);
+    inst.override_material = 1;
+    inst.mat = mat;
+    return inst;
+}
+
+/* Intersects in object space; t carries over because the direction is not renormalised */
+static inline int instance_hit(const instance *inst, ray r, double t_min, double t_max, hit_record *rec) {
+    ray local = transform_ray_to_object(&inst->xf, r);
+    if (!geometry_hit(inst->geom, local, t_min, t_max, rec))
+        return 0;
+
+    /* front_face is unchanged: the dot product of direction and normal is preserved */
+    rec->p = ray_at(r, rec->t);
+    rec->normal = transform_normal_to_world(&inst->xf, rec->normal);
+    if (inst->override_material)
+        rec->mat = inst->mat;
+    return 1;
+}
+
+#endif
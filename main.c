@@ -1,10 +1,16 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <pthread.h>
 #include <time.h>
 
+/* Built against a scene header from --emit-c (make compiled); it must come before the other headers */
+#ifdef COMPILED_SCENE
+#include COMPILED_SCENE
+#endif
+
 #include "vec3.h"
 #include "ray.h"
 #include "color.h"
@@ -15,14 +21,30 @@
 #include "triangle.h"
 #include "scene.h"
 #include "texture.h"
+#include "accum.h"
+#include "render.h"
+#include "options.h"
+#include "video.h"
+#include "scene_gen.h"
+#include "daemon.h"
+#include "emit.h"
+#include "incremental.h"
+#include "shmfb.h"
+#include "imagefile.h"
 
-/* Rendering configuration */
+/* Rendering configuration (defaults; see --help for command-line overrides) */
 #define IMAGE_WIDTH 1920
 #define ASPECT_RATIO (16.0 / 9.0)
 #define IMAGE_HEIGHT ((int)(IMAGE_WIDTH / ASPECT_RATIO))
 #define SAMPLES_PER_PIXEL 200
 #define MAX_DEPTH 100
 #define NUM_THREADS 8
+#define PREVIEW_START_SCALE 8  /* --preview starts at 1/8 resolution */
+
+/* --scene forest: instance count and tessellation of the shared asset (2 * stacks * slices triangles) */
+#define FOREST_INSTANCES 10000
+#define FOREST_ASSET_STACKS 224
+#define FOREST_ASSET_SLICES 224
 
 /* Animation configuration */
 #define TOTAL_FRAMES 300
@@ -30,63 +52,30 @@
 #ifndef ENABLE_ANIMATION
 #define ENABLE_ANIMATION 0  /* Default: static image. Override with -DENABLE_ANIMATION=1 */
 #endif
+#if defined(SCENE_COMPILED) && ENABLE_ANIMATION
+#error "a compiled scene is a single frame; it cannot be animated"
+#endif
 
-/* Global scene and camera */
+/* Fixed seed for scene construction, so every process builds the same scene */
+#define SCENE_SEED 1337u
+
+/* Global scene */
 static scene world;
-static camera cam;
-static unsigned char *image_buffer;
-
-/* Thread data */
-typedef struct {
-    int start_row;
-    int end_row;
-    unsigned int seed;
-} thread_data;
-
-static vec3 ray_color(ray r, scene *world, int depth) {
-    if (depth <= 0)
-        return vec3_create(0, 0, 0);
-
-    hit_record rec;
-    if (scene_hit(world, r, 0.001, 1e30, &rec)) {
-        ray scattered;
-        vec3 attenuation;
-        if (material_scatter(rec.mat, r, &rec, &attenuation, &scattered))
-            return vec3_mul(attenuation, ray_color(scattered, world, depth - 1));
-        return vec3_create(0, 0, 0);
-    }
-
-    /* Sky gradient */
-    vec3 unit_dir = vec3_unit(r.direction);
-    double t = 0.5 * (unit_dir.y + 1.0);
-    return vec3_add(
-        vec3_scale(vec3_create(1.0, 1.0, 1.0), 1.0 - t),
-        vec3_scale(vec3_create(0.5, 0.7, 1.0), t));
-}
 
-static void *render_thread(void *arg) {
-    thread_data *data = (thread_data *)arg;
-    tl_seed = data->seed;
-
-    for (int j = data->start_row; j < data->end_row; j++) {
-        for (int i = 0; i < IMAGE_WIDTH; i++) {
-            vec3 pixel_color = vec3_create(0, 0, 0);
-            for (int s = 0; s < SAMPLES_PER_PIXEL; s++) {
-                double u = (i + random_double()) / (IMAGE_WIDTH - 1);
-                double v = (j + random_double()) / (IMAGE_HEIGHT - 1);
-                ray r = camera_get_ray(&cam, u, v);
-                pixel_color = vec3_add(pixel_color, ray_color(r, &world, MAX_DEPTH));
-            }
-            int row = IMAGE_HEIGHT - 1 - j;
-            int idx = (row * IMAGE_WIDTH + i) * 3;
-            write_color_to_buffer(image_buffer, idx, pixel_color, SAMPLES_PER_PIXEL);
-        }
-    }
-    return NULL;
+/* Radiance cache (--radiance-cache) and path guide (--guide), shared by every render job of a frame */
+static radiance_cache world_cache;
+static path_guide world_guide;
+
+/* Live framebuffer (--publish) the render jobs copy finished tiles to */
+static shmfb world_fb;
+
+static void unpublish(void) {
+    shmfb_close(&world_fb);
 }
 
 static void build_scene(double frame_time) {
     scene_init(&world);
+    tl_seed = SCENE_SEED;
 
     /* Initialize Perlin noise before threads are spawned */
     perlin_init();
@@ -167,134 +156,1011 @@ static void build_scene(double frame_time) {
     scene_add_triangle(&world, (triangle){pA, pB, pC, pyramid_mat});
 }
 
-int main(void) {
-    tl_seed = (unsigned int)time(NULL);
 
-    /* Allocate image buffer */
-    image_buffer = (unsigned char *)malloc(IMAGE_WIDTH * IMAGE_HEIGHT * 3);
-    if (!image_buffer) {
-        fprintf(stderr, "Error: Failed to allocate image buffer\n");
-        return 1;
+/*
+ * Instancing showcase: FOREST_INSTANCES copies of one ~100k-triangle shrub,
+ * each with its own transform and colour. Only the shared asset is stored
+ * triangle by triangle; every copy costs one transform.
+ */
+static geometry forest_asset;
+
+static int build_forest_asset(void) {
+    if (forest_asset.num_triangles > 0)
+        return 0;
+
+    /* Displaced sphere: a lumpy crown centred one unit above the ground */
+    material leaf = mat_lambertian(vec3_create(0.2, 0.5, 0.15));
+    vec3 (*grid)[FOREST_ASSET_SLICES + 1] =
+        (vec3 (*)[FOREST_ASSET_SLICES + 1])malloc(sizeof(*grid) * (FOREST_ASSET_STACKS + 1));
+    if (!grid)
+        return -1;
+    for (int i = 0; i <= FOREST_ASSET_STACKS; i++) {
+        double theta = M_PI * i / FOREST_ASSET_STACKS;
+        for (int k = 0; k <= FOREST_ASSET_SLICES; k++) {
+            double phi = 2.0 * M_PI * k / FOREST_ASSET_SLICES;
+            vec3 dir = vec3_create(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            double r = 1.0 + 0.12 * sin(7.0 * theta) * sin(9.0 * phi) + 0.05 * sin(31.0 * theta + 17.0 * phi);
+            grid[i][k] = vec3_add(vec3_create(0, 1, 0), vec3_scale(dir, r));
+        }
+    }
+    for (int i = 0; i < FOREST_ASSET_STACKS; i++) {
+        for (int k = 0; k < FOREST_ASSET_SLICES; k++) {
+            vec3 a = grid[i][k], b = grid[i][k + 1], c = grid[i + 1][k + 1], d = grid[i + 1][k];
+            if (geometry_add_triangle(&forest_asset, (triangle){a, b, c, leaf}) != 0
+                || geometry_add_triangle(&forest_asset, (triangle){a, c, d, leaf}) != 0) {
+                free(grid);
+                return -1;
+            }
+        }
     }
+    free(grid);
+    return geometry_commit(&forest_asset);
+}
 
-#if ENABLE_ANIMATION
-    fprintf(stderr, "Rendering %d frame animation (%dx%d, %d samples/pixel, %d threads)...\n",
-            TOTAL_FRAMES, IMAGE_WIDTH, IMAGE_HEIGHT, SAMPLES_PER_PIXEL, NUM_THREADS);
+static int build_forest_scene(double frame_time) {
+    scene_init(&world);
+    tl_seed = SCENE_SEED;
+    perlin_init();
 
-    for (int frame = 0; frame < TOTAL_FRAMES; frame++) {
-        double frame_time = (double)frame / FPS;
-        
-        /* Build scene for this frame */
+    if (build_forest_asset() != 0)
+        return -1;
+
+    scene_add_plane(&world, (plane){
+        vec3_create(0, 0, 0),
+        vec3_create(0, 1, 0),
+        mat_lambertian_tex(texture_checker(vec3_create(0.3, 0.25, 0.1), vec3_create(0.5, 0.45, 0.3), 2.0))
+    });
+
+    int side = (int)sqrt((double)FOREST_INSTANCES);
+    double spacing = 2.5;
+    for (int a = 0; a < side; a++) {
+        for (int b = 0; b < side; b++) {
+            vec3 pos = vec3_create(
+                (a - side / 2) * spacing + random_double_range(-0.8, 0.8),
+                0.0,
+                (b - side / 2) * spacing + random_double_range(-0.8, 0.8));
+            double scale = random_double_range(0.6, 1.2);
+            double sway = 0.1 * sin(frame_time * 2.0 + a * 0.3 + b * 0.2);
+            transform xf = transform_create(pos, random_double() * 2.0 * M_PI + sway,
+                                            vec3_create(scale, scale * random_double_range(0.8, 1.6), scale));
+            material mat = random_double() < 0.1
+                ? mat_metal(vec3_create(0.8, 0.6, 0.2), 0.3)
+                : mat_lambertian(vec3_create(random_double_range(0.05, 0.3),
+                                             random_double_range(0.3, 0.6),
+                                             random_double_range(0.05, 0.2)));
+            scene_add_instance(&world, instance_create_mat(&forest_asset, xf, mat));
+        }
+    }
+    return 0;
+}
+
+/* Two triangles covering the quad a-b-c-d */
+static void add_quad(vec3 a, vec3 b, vec3 c, vec3 d, material mat) {
+    scene_add_triangle(&world, (triangle){a, b, c, mat});
+    scene_add_triangle(&world, (triangle){a, c, d, mat});
+}
+
+/*
+ * --scene skylight: a closed 10 x 5 x 10 room lit only by the sky through a
+ * 2 x 2 opening in the ceiling, with a glass sphere under the opening
+ * throwing a caustic. Hard lighting for testing path guiding.
+ */
+static void build_skylight_scene(void) {
+    scene_init(&world);
+    tl_seed = SCENE_SEED;
+    perlin_init();
+
+    material white = mat_lambertian(vec3_create(0.73, 0.73, 0.73));
+    material red = mat_lambertian(vec3_create(0.65, 0.05, 0.05));
+    material green = mat_lambertian(vec3_create(0.12, 0.45, 0.15));
+    double s = 5.0, h = 5.0, o = 1.0;   /* half width, height, half opening */
+
+    scene_add_plane(&world, (plane){vec3_create(0, 0, 0), vec3_create(0, 1, 0), white});
+    add_quad(vec3_create(-s, 0, -s), vec3_create(s, 0, -s), vec3_create(s, h, -s), vec3_create(-s, h, -s), white);
+    add_quad(vec3_create(-s, 0, s), vec3_create(-s, h, s), vec3_create(s, h, s), vec3_create(s, 0, s), white);
+    add_quad(vec3_create(-s, 0, -s), vec3_create(-s, h, -s), vec3_create(-s, h, s), vec3_create(-s, 0, s), red);
+    add_quad(vec3_create(s, 0, -s), vec3_create(s, 0, s), vec3_create(s, h, s), vec3_create(s, h, -s), green);
+
+    /* Ceiling around the opening */
+    add_quad(vec3_create(-s, h, -s), vec3_create(s, h, -s), vec3_create(s, h, -o), vec3_create(-s, h, -o), white);
+    add_quad(vec3_create(-s, h, o), vec3_create(s, h, o), vec3_create(s, h, s), vec3_create(-s, h, s), white);
+    add_quad(vec3_create(-s, h, -o), vec3_create(-o, h, -o), vec3_create(-o, h, o), vec3_create(-s, h, o), white);
+    add_quad(vec3_create(o, h, -o), vec3_create(s, h, -o), vec3_create(s, h, o), vec3_create(o, h, o), white);
+
+    scene_add_sphere(&world, (sphere){vec3_create(0, 1, 0), 1.0, mat_dielectric(1.5)});
+    scene_add_sphere(&world, (sphere){vec3_create(-2.5, 1, -2), 1.0, mat_lambertian(vec3_create(0.4, 0.4, 0.7))});
+    scene_add_sphere(&world, (sphere){vec3_create(2.5, 1, -1.5), 1.0, mat_metal(vec3_create(0.8, 0.8, 0.8), 0.05)});
+}
+
+/* --scene stress: procedurally generated scene for scaling measurements */
+static int build_stress_scene(const render_options *opts) {
+    scene_init(&world);
+    tl_seed = SCENE_SEED;
+    perlin_init();
+
+    if ((uint32_t)opts->prims > SCENE_PRIM_INDEX_MASK + 1u) {
+        fprintf(stderr, "Error: --prims is limited to %u primitives\n", SCENE_PRIM_INDEX_MASK + 1u);
+        return -1;
+    }
+    scene_gen_params params = scene_gen_defaults((uint32_t)opts->prims);
+    params.triangle_fraction = opts->triangle_percent / 100.0;
+    if (opts->distribution && scene_gen_parse_distribution(opts->distribution, &params.distribution) != 0) {
+        fprintf(stderr, "Error: unknown distribution '%s' (uniform, clustered, layer)\n", opts->distribution);
+        return -1;
+    }
+    if (scene_generate(&world, &params) != 0) {
+        fprintf(stderr, "Error: Failed to allocate %d primitives\n", opts->prims);
+        return -1;
+    }
+    return 0;
+}
+
+/* Builds the scene picked with --scene and its acceleration structures */
+static int build_world(const render_options *opts, double frame_time) {
+    double start = render_clock();
+    const char *name = opts->scene_name;
+
+#ifdef SCENE_COMPILED
+    /* The geometry is baked into the binary; the scene only has to match for its camera */
+    if (strcmp(name, COMPILED_SCENE_NAME) != 0) {
+        fprintf(stderr, "Error: this binary was compiled for scene '%s'\n", COMPILED_SCENE_NAME);
+        return -1;
+    }
+    scene_init(&world);
+    fprintf(stderr, "Scene: %d primitives, compiled in.\n", COMPILED_NUM_PRIMITIVES);
+    return 0;
+#endif
+
+    if (!strcmp(name, "demo")) {
         build_scene(frame_time);
+    } else if (!strcmp(name, "forest")) {
+        if (build_forest_scene(frame_time) != 0) {
+            fprintf(stderr, "Error: Failed to allocate forest geometry\n");
+            return -1;
+        }
+    } else if (!strcmp(name, "stress")) {
+        if (build_stress_scene(opts) != 0)
+            return -1;
+    } else if (!strcmp(name, "skylight")) {
+        build_skylight_scene();
+    } else {
+        fprintf(stderr, "Error: unknown scene '%s' (demo, forest, stress, skylight)\n", name);
+        return -1;
+    }
+    double built = render_clock();
+    if (scene_commit(&world) != 0) {
+        fprintf(stderr, "Error: Failed to build acceleration structures\n");
+        return -1;
+    }
+    fprintf(stderr, "Scene: %u primitives, %.1f MB, built in %.2f seconds (BVH %.2f seconds).\n",
+            scene_num_primitives(&world), scene_memory(&world) / (1024.0 * 1024.0),
+            render_clock() - start, render_clock() - built);
+    return 0;
+}
+
+/* The scene's camera placement at `frame_time`, with any --lookfrom/--lookat/--fov applied */
+static camera_view world_view(const render_options *opts, double frame_time) {
+    const char *name = opts->scene_name;
+    camera_view view;
+    view.vup = vec3_create(0, 1, 0);
+    view.aperture = 0.1;
 
+    if (!strcmp(name, "stress")) {
+        /* Looking at the generator's cube (half-size 10, resting on y = 0) from a corner */
+        double cam_angle = 0.8 + frame_time * 0.2;
+        view.lookfrom = vec3_create(34.0 * cos(cam_angle), 22.0, 34.0 * sin(cam_angle));
+        view.lookat = vec3_create(0, 6, 0);
+        view.vfov = 40.0;
+        view.aperture = 0.0;
+        view.focus_dist = vec3_length(vec3_sub(view.lookfrom, view.lookat));
+    } else if (!strcmp(name, "skylight")) {
+        /* Inside the room, in front of the near wall */
+        view.lookfrom = vec3_create(0, 2.5, 4.6);
+        view.lookat = vec3_create(0, 1.8, 0);
+        view.vfov = 70.0;
+        view.aperture = 0.0;
+        view.focus_dist = vec3_length(vec3_sub(view.lookfrom, view.lookat));
+    } else if (!strcmp(name, "forest")) {
+        double cam_angle = 0.6 + frame_time * 0.1;
+        view.lookfrom = vec3_create(60.0 * cos(cam_angle), 18.0, 60.0 * sin(cam_angle));
+        view.lookat = vec3_create(0, 0, 0);
+        view.vfov = 35.0;
+        view.focus_dist = vec3_length(view.lookfrom);
+    } else {
+#if ENABLE_ANIMATION
         /* Animate camera - circular orbit around scene */
         double cam_angle = frame_time * 0.3;
         double cam_distance = 15.0 + 3.0 * sin(frame_time * 0.5);
-        vec3 lookfrom = vec3_create(
+        view.lookfrom = vec3_create(
             cam_distance * cos(cam_angle),
             2.0 + 1.5 * sin(frame_time * 0.7),
             cam_distance * sin(cam_angle)
         );
-        vec3 lookat = vec3_create(0, 0.5, 0);
-        vec3 vup = vec3_create(0, 1, 0);
-        double dist_to_focus = 10.0;
-        double aperture = 0.1;
+        view.lookat = vec3_create(0, 0.5, 0);
+#else
+        view.lookfrom = vec3_create(13, 2, 3);
+        view.lookat = vec3_create(0, 0, 0);
+#endif
+        view.vfov = 20.0;
+        view.focus_dist = 10.0;
+    }
 
-        cam = camera_create(lookfrom, lookat, vup, 20.0, ASPECT_RATIO, aperture, dist_to_focus);
+    /* Overrides keep the new target in focus */
+    if (opts->lookfrom_set)
+        view.lookfrom = vec3_create(opts->lookfrom[0], opts->lookfrom[1], opts->lookfrom[2]);
+    if (opts->lookat_set)
+        view.lookat = vec3_create(opts->lookat[0], opts->lookat[1], opts->lookat[2]);
+    if (opts->lookfrom_set || opts->lookat_set)
+        view.focus_dist = vec3_length(vec3_sub(view.lookfrom, view.lookat));
+    if (opts->fov > 0.0)
+        view.vfov = opts->fov;
+    return view;
+}
 
-        /* Multi-threaded rendering for this frame */
-        struct timespec start_time, end_time;
-        clock_gettime(CLOCK_MONOTONIC, &start_time);
-
-        pthread_t threads[NUM_THREADS];
-        thread_data tdata[NUM_THREADS];
-        int rows_per_thread = IMAGE_HEIGHT / NUM_THREADS;
-
-        for (int t = 0; t < NUM_THREADS; t++) {
-            tdata[t].start_row = t * rows_per_thread;
-            tdata[t].end_row = (t == NUM_THREADS - 1) ? IMAGE_HEIGHT : (t + 1) * rows_per_thread;
-            tdata[t].seed = (unsigned int)(time(NULL) + t + frame);
-            pthread_create(&threads[t], NULL, render_thread, &tdata[t]);
+static camera world_camera(const render_options *opts, double frame_time, double aspect) {
+    camera_view view = world_view(opts, frame_time);
+    return camera_from_view(&view, aspect);
+}
+
+/* Resolves a buffer and writes it, scaled up to out_width x out_height by pixel replication */
+static int write_image(const accum_buffer *acc, const char *path, int out_width, int out_height) {
+    unsigned char *image_buffer = (unsigned char *)malloc((size_t)acc->width * acc->rows * 3);
+    unsigned char *out_buffer = image_buffer;
+    if (!image_buffer) {
+        fprintf(stderr, "Error: Failed to allocate image buffer\n");
+        return -1;
+    }
+    accum_resolve(acc, image_buffer);
+
+    if (out_width != acc->width || out_height != acc->rows) {
+        out_buffer = (unsigned char *)malloc((size_t)out_width * out_height * 3);
+        if (!out_buffer) {
+            fprintf(stderr, "Error: Failed to allocate image buffer\n");
+            free(image_buffer);
+            return -1;
+        }
+        for (int y = 0; y < out_height; y++) {
+            int sy = (int)((long)y * acc->rows / out_height);
+            for (int x = 0; x < out_width; x++) {
+                int sx = (int)((long)x * acc->width / out_width);
+                memcpy(&out_buffer[((size_t)y * out_width + x) * 3],
+                       &image_buffer[((size_t)sy * acc->width + sx) * 3], 3);
+            }
         }
+    }
 
-        for (int t = 0; t < NUM_THREADS; t++) {
-            pthread_join(threads[t], NULL);
+    int rc = image_write_file(out_buffer, path, out_width, out_height);
+    if (out_buffer != image_buffer)
+        free(out_buffer);
+    free(image_buffer);
+    return rc;
+}
+
+/*
+ * Preview: 1 sample/pixel renders at 1/8, 1/4 and 1/2 resolution, each written
+ * over the output as soon as it is done, before the full-resolution passes.
+ * The first level ignores the deadline so there is always an image. The last
+ * complete level is kept in `best` (best->rgb is NULL if allocation failed).
+ */
+static void render_preview_levels(const render_options *opts, camera cam, int frame, const render_job *full,
+                                  double start, accum_buffer *best) {
+    best->rgb = NULL;
+    best->samples = NULL;
+    for (int scale = PREVIEW_START_SCALE; scale > 1; scale /= 2) {
+        int w = (opts->width + scale - 1) / scale;
+        int h = (opts->height + scale - 1) / scale;
+        accum_buffer small;
+        if (accum_create(&small, w, h, 0, h) != 0)
+            return;
+
+        render_job job;
+        render_job_init(&job, &world, cam, w, h, opts->max_depth, &small, opts->seed, frame);
+        job.deadline = scale == PREVIEW_START_SCALE ? 0.0 : full->deadline;
+        job.cache = full->cache;
+        if (!render_run(&job, opts->threads)) {
+            accum_free(&small);
+            return;
         }
+        if (write_image(&small, opts->output, opts->width, opts->height) == 0)
+            fprintf(stderr, "Preview 1/%d resolution written after %.2f seconds.\n",
+                    scale, render_clock() - start);
+        accum_free(best);
+        *best = small;
+    }
+}
 
-        clock_gettime(CLOCK_MONOTONIC, &end_time);
-        double elapsed = (end_time.tv_sec - start_time.tv_sec)
-                       + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+/* --visibility: candidate lists for the camera rays of one image; vis->tiles stays NULL without it */
+static int visibility_setup(const render_options *opts, camera cam, visibility *vis) {
+    vis->tiles = NULL;
+    if (!opts->visibility)
+        return 0;
+    if (visibility_create(vis, &world, cam, opts->width, opts->height,
+                          render_tile_count(opts->width, opts->height)) != 0) {
+        fprintf(stderr, "Error: Failed to allocate visibility buffer\n");
+        return -1;
+    }
+    return 0;
+}
 
-        /* Write PPM frame to file */
-        char filename[64];
-        snprintf(filename, sizeof(filename), "frame_%04d.ppm", frame);
-        FILE *f = fopen(filename, "wb");
-        if (!f) {
-            fprintf(stderr, "Error: Failed to open %s\n", filename);
-            free(image_buffer);
-            return 1;
+static void visibility_finish(visibility *vis) {
+    if (!vis->tiles)
+        return;
+    uint64_t quads = atomic_load(&vis->quads), rays = atomic_load(&vis->rays);
+    if (quads > 0 && rays > 0)
+        fprintf(stderr, "Visibility: %.1f candidate primitives per pixel quad, %.1f%% of camera rays "
+                        "traced the whole scene.\n",
+                (double)atomic_load(&vis->candidates) / quads, 100.0 * atomic_load(&vis->traced) / rays);
+    visibility_free(vis);
+}
+
+/* Renders this process's share of one frame into `acc`, allocated here. */
+static int render_frame(const render_options *opts, camera cam, int frame, accum_buffer *acc) {
+    double start = render_clock();
+    visibility vis;
+    if (visibility_setup(opts, cam, &vis) != 0)
+        return -1;
+    int y0, y1;
+    render_tile_rows(opts->width, opts->height, opts->tile_begin, opts->tile_end, &y0, &y1);
+    if (accum_create(acc, opts->width, opts->height, y0, y1 - y0) != 0
+        || accum_add_range(acc, (accum_range){opts->tile_begin, opts->tile_end,
+                                              opts->sample_begin, opts->sample_end}) != 0) {
+        fprintf(stderr, "Error: Failed to allocate accumulation buffer\n");
+        accum_free(acc);
+        visibility_free(&vis);
+        return -1;
+    }
+    acc->frame = frame;
+
+    render_job job;
+    render_job_init(&job, &world, cam, opts->width, opts->height, opts->max_depth, acc, opts->seed, frame);
+    job.tile_begin = opts->tile_begin;
+    job.tile_end = opts->tile_end;
+    job.sample_begin = opts->sample_begin;
+    job.sample_end = opts->sample_end;
+    if (opts->budget > 0.0)
+        job.deadline = start + opts->budget;
+    if (opts->cache_cell > 0.0)
+        job.cache = &world_cache;
+    if (opts->guide_cell > 0.0)
+        job.guide = &world_guide;
+    if (opts->publish) {
+        uint64_t pixels = 0;
+        for (int t = opts->tile_begin; t < opts->tile_end; t++)
+            pixels += (uint64_t)render_tile_pixels(opts->width, opts->height, t);
+        shmfb_begin_frame(&world_fb, frame, pixels * (uint64_t)(opts->sample_end - opts->sample_begin));
+        job.publish = &world_fb;
+    }
+    if (vis.tiles)
+        job.vis = &vis;
+
+    /* Guiding learns between passes, so it always renders progressively */
+    if (!opts->preview && opts->budget <= 0.0 && !job.guide) {
+        render_run(&job, opts->threads);
+        visibility_finish(&vis);
+        return 0;
+    }
+
+    accum_buffer preview = {0};
+    if (opts->preview)
+        render_preview_levels(opts, cam, frame, &job, start, &preview);
+
+    /*
+     * Progressive passes over the whole image until done or out of time. The
+     * caller writes `acc`, so every pixel needs a sample: without a preview to
+     * fill in from, the first pass ignores the deadline.
+     */
+    int total = opts->sample_end - opts->sample_begin;
+    int done = 0;
+    double deadline = job.deadline;
+    while (done < total) {
+        int n = render_pass_samples(done);
+        if (n > total - done)
+            n = total - done;
+        job.sample_begin = opts->sample_begin + done;
+        job.sample_end = job.sample_begin + n;
+        job.deadline = done == 0 && !preview.rgb ? 0.0 : deadline;
+
+        int complete = render_run(&job, opts->threads);
+        if (complete)
+            done += n;
+        if (job.guide)
+            guide_update(job.guide);
+        if (!complete) {
+            if (done == 0)
+                accum_fill_unsampled(acc, &preview);   /* tiles the first pass missed keep the preview */
+            fprintf(stderr, "Time budget reached: %d of %d samples/pixel everywhere, %d more on part of the image.\n",
+                    done, total, n);
+            break;
+        }
+        /* The last pass is written by the caller */
+        if (opts->preview && done < total && write_image(acc, opts->output, acc->width, acc->rows) == 0)
+            fprintf(stderr, "Refined to %d samples/pixel after %.2f seconds.\n", done, render_clock() - start);
+    }
+    accum_free(&preview);
+    visibility_finish(&vis);
+    return 0;
+}
+
+/* --incremental and --mem-budget render single still images */
+#if !ENABLE_ANIMATION
+#ifndef SCENE_COMPILED
+/* Hash of every input besides the primitives that a change of would alter every pixel */
+static uint64_t incremental_settings(const render_options *opts, const camera *cam, unsigned int seed) {
+    uint64_t h = INCR_VERSION;
+    h = incr_mix(h, (uint64_t)opts->width);
+    h = incr_mix(h, (uint64_t)opts->height);
+    h = incr_mix(h, (uint64_t)opts->samples);
+    h = incr_mix(h, (uint64_t)opts->max_depth);
+    h = incr_mix(h, seed);
+    h = incr_mix_vec3(h, cam->origin);
+    h = incr_mix_vec3(h, cam->lower_left_corner);
+    h = incr_mix_vec3(h, cam->horizontal);
+    h = incr_mix_vec3(h, cam->vertical);
+    h = incr_mix_double(h, cam->lens_radius);
+    h = incr_mix_vec3(h, vec3_create(RENDER_SKY_BOTTOM));
+    return incr_mix_vec3(h, vec3_create(RENDER_SKY_TOP));
+}
+
+/*
+ * --incremental, first half: loads the stored render into `old`, sets up
+ * `cur` (its image and tile records start as the stored ones, cleared where
+ * they must be redone) and lists the tiles to render in `dirty`.
+ */
+static int incremental_plan(const render_options *opts, camera cam, incr_state *old, incr_state *cur,
+                            int *dirty, int *num_dirty) {
+    int w = opts->width, h = opts->height;
+    int num_tiles = render_tile_count(w, h);
+    if (incr_scene_hash(&world, &cur->scene) != 0) {
+        fprintf(stderr, "Error: Failed to allocate incremental render state\n");
+        return -1;
+    }
+
+    /* Without --seed, keep the stored image's seed so unchanged tiles still match */
+    int loaded = incr_load(old, opts->incremental);
+    cur->seed = loaded == 0 && !opts->seed_set ? old->seed : opts->seed;
+    cur->settings = incremental_settings(opts, &cam, cur->seed);
+    cur->num_tiles = num_tiles;
+
+    const char *full_reason = NULL;
+    if (loaded != 0)
+        full_reason = "no usable previous render";
+    else if (old->settings != cur->settings || old->num_tiles != num_tiles || old->acc.width != w
+             || old->acc.height != h || old->acc.y0 != 0 || old->acc.rows != h)
+        full_reason = "camera or render settings changed";
+
+    if (full_reason) {
+        fprintf(stderr, "Incremental: %s, rendering every tile.\n", full_reason);
+        cur->tiles = (incr_tile *)calloc((size_t)num_tiles, sizeof(incr_tile));
+        if (!cur->tiles || accum_create(&cur->acc, w, h, 0, h) != 0) {
+            fprintf(stderr, "Error: Failed to allocate accumulation buffer\n");
+            return -1;
         }
+        for (int t = 0; t < num_tiles; t++)
+            dirty[(*num_dirty)++] = t;
+        return 0;
+    }
 
-        fprintf(f, "P3\n%d %d\n255\n", IMAGE_WIDTH, IMAGE_HEIGHT);
-        for (int j = 0; j < IMAGE_HEIGHT; j++) {
-            for (int i = 0; i < IMAGE_WIDTH; i++) {
-                int idx = (j * IMAGE_WIDTH + i) * 3;
-                fprintf(f, "%d %d %d\n", image_buffer[idx], image_buffer[idx + 1], image_buffer[idx + 2]);
-            }
+    incr_changes changes;
+    if (incr_diff(&old->scene, &cur->scene, &changes) != 0) {
+        fprintf(stderr, "Error: Failed to allocate incremental render state\n");
+        return -1;
+    }
+    if (changes.num_changed > 0) {
+        /* Where the changed primitives are now: camera rays and first bounces only, few samples */
+        incr_tile *probe = (incr_tile *)calloc((size_t)num_tiles, sizeof(incr_tile));
+        accum_buffer scratch;
+        int probed = probe && accum_create(&scratch, w, h, 0, h) == 0;
+        if (probed) {
+            render_job job;
+            render_job_init(&job, &world, cam, w, h, 1 + INCR_RECORD_BOUNCES, &scratch, cur->seed, 0);
+            job.sample_end = INCR_PROBE_SAMPLES;
+            job.records = probe;
+            render_run(&job, opts->threads);
+            accum_free(&scratch);
         }
-        fclose(f);
+        /* Without a probe every tile counts as dirty */
+        for (int t = 0; t < num_tiles; t++)
+            if (!probed || incr_tile_dirty(&old->tiles[t], &changes) || incr_tile_dirty(&probe[t], &changes))
+                dirty[(*num_dirty)++] = t;
+        incr_tiles_free(probe, num_tiles);
+    }
+    fprintf(stderr, "Incremental: %u primitives changed, re-rendering %d of %d tiles.\n",
+            changes.num_changed, *num_dirty, num_tiles);
+    incr_changes_free(&changes);
 
-        fprintf(stderr, "Frame %d/%d complete in %.2f seconds.\n", frame + 1, TOTAL_FRAMES, elapsed);
+    cur->acc = old->acc;
+    cur->tiles = old->tiles;
+    old->acc.rgb = NULL;
+    old->acc.samples = NULL;
+    old->tiles = NULL;
+    int tx = render_tiles_x(w);
+    for (int i = 0; i < *num_dirty; i++) {
+        int x0 = (dirty[i] % tx) * TILE_SIZE, y0 = (dirty[i] / tx) * TILE_SIZE;
+        accum_clear_rect(&cur->acc, x0, y0, x0 + TILE_SIZE < w ? x0 + TILE_SIZE : w,
+                         y0 + TILE_SIZE < h ? y0 + TILE_SIZE : h);
+        free(cur->tiles[dirty[i]].ids);
+        cur->tiles[dirty[i]] = (incr_tile){0, NULL};
+    }
+    return 0;
+}
+
+#endif
+
+/*
+ * --incremental: renders into `acc` (allocated here) only the tiles that the
+ * scene's changes since the render stored in opts->incremental can affect,
+ * keeping the stored image elsewhere, then stores the new state.
+ */
+static int render_incremental(const render_options *opts, camera cam, accum_buffer *acc) {
+#ifdef SCENE_COMPILED
+    /* Compiled scenes have no primitive ids to record */
+    (void)opts;
+    (void)cam;
+    (void)acc;
+    fprintf(stderr, "Error: --incremental needs the generic build\n");
+    return -1;
+#else
+    incr_state old, cur;
+    memset(&old, 0, sizeof(old));
+    memset(&cur, 0, sizeof(cur));
+    int num_tiles = render_tile_count(opts->width, opts->height);
+    int *dirty = (int *)malloc(sizeof(int) * (size_t)num_tiles);
+    int num_dirty = 0;
+    int rc = dirty ? incremental_plan(opts, cam, &old, &cur, dirty, &num_dirty) : -1;
+
+    /* Viewers see the kept tiles at once and the dirty ones as they are redone */
+    if (rc == 0 && opts->publish) {
+        uint64_t pixels = 0;
+        for (int i = 0; i < num_dirty; i++)
+            pixels += (uint64_t)render_tile_pixels(opts->width, opts->height, dirty[i]);
+        shmfb_begin_frame(&world_fb, 0, pixels * (uint64_t)opts->samples);
+        shmfb_publish_all(&world_fb, &cur.acc);
+    }
+    if (rc == 0 && num_dirty > 0) {
+        render_job job;
+        render_job_init(&job, &world, cam, opts->width, opts->height, opts->max_depth, &cur.acc, cur.seed, 0);
+        job.tile_list = dirty;
+        job.tile_end = num_dirty;
+        job.sample_end = opts->samples;
+        job.records = cur.tiles;
+        if (opts->publish)
+            job.publish = &world_fb;
+        visibility vis;
+        rc = visibility_setup(opts, cam, &vis);
+        if (rc == 0) {
+            if (vis.tiles)
+                job.vis = &vis;
+            render_run(&job, opts->threads);
+        }
+        visibility_finish(&vis);
     }
+    if (rc == 0)
+        rc = incr_save(&cur, opts->incremental);
+    if (rc == 0) {
+        *acc = cur.acc;     /* handed to the caller */
+        cur.acc.rgb = NULL;
+        cur.acc.samples = NULL;
+    }
+    free(dirty);
+    incr_state_free(&old);
+    incr_state_free(&cur);
+    return rc;
+#endif
+}
+
+/*
+ * --mem-budget: renders the image top to bottom in bands of whole tile rows,
+ * as tall as the budget allows, and streams each finished band to the output
+ * on a writer thread while the next one renders. Memory depends on the width
+ * and the budget, never on the height.
+ */
+static int render_streamed(const render_options *opts, camera cam) {
+    int w = opts->width, h = opts->height;
 
+    /* Per band row: the accumulation, two stream slots and a PNG chunk of RGB24 */
+    size_t row_bytes = (size_t)w * (3 * sizeof(float) + sizeof(uint32_t)) + image_stream_bytes(w, 1) + (size_t)w * 3;
+    double budget = opts->mem_budget * 1024.0 * 1024.0;
+    double max_rows = budget / (double)row_bytes;
+    int all_rows = render_tiles_y(h) * TILE_SIZE;
+    int band_rows = max_rows >= all_rows ? all_rows : (int)max_rows / TILE_SIZE * TILE_SIZE;
+    if (band_rows < TILE_SIZE) {
+        fprintf(stderr, "Error: --mem-budget: a %d-pixel-wide image needs at least %.1f MB\n",
+                w, (double)row_bytes * TILE_SIZE / (1024.0 * 1024.0));
+        return -1;
+    }
+    if (band_rows > h)
+        band_rows = h;
+    fprintf(stderr, "Streaming %d bands of up to %d rows (%.1f MB of buffers).\n",
+            (h + band_rows - 1) / band_rows, band_rows, (double)row_bytes * band_rows / (1024.0 * 1024.0));
+
+    accum_buffer acc;
+    if (accum_create(&acc, w, h, 0, band_rows) != 0) {
+        fprintf(stderr, "Error: Failed to allocate accumulation buffer\n");
+        return -1;
+    }
+    /* Written in place, not renamed: the top of the image is there to look at while the rest renders */
+    FILE *f = opts->output ? fopen(opts->output, "wb") : stdout;
+    if (!f) {
+        fprintf(stderr, "Error: Failed to open %s\n", opts->output);
+        accum_free(&acc);
+        return -1;
+    }
+    image_stream stream;
+    visibility vis;
+    int rc = visibility_setup(opts, cam, &vis);
+    if (rc == 0)
+        rc = image_stream_open(&stream, f, image_format_for(opts->output), w, h, band_rows);
+    if (rc == 0) {
+        int tx = render_tiles_x(w);
+        for (int y0 = 0; y0 < h && rc == 0; y0 += band_rows) {
+            acc.y0 = y0;
+            acc.rows = y0 + band_rows < h ? band_rows : h - y0;
+            accum_clear(&acc);
+
+            render_job job;
+            render_job_init(&job, &world, cam, w, h, opts->max_depth, &acc, opts->seed, 0);
+            job.tile_begin = y0 / TILE_SIZE * tx;
+            job.tile_end = render_tiles_y(y0 + acc.rows) * tx;
+            job.sample_end = opts->samples;
+            if (opts->cache_cell > 0.0)
+                job.cache = &world_cache;
+            if (vis.tiles)
+                job.vis = &vis;
+            render_run(&job, opts->threads);
+            if (job.vis)
+                visibility_release(&vis, job.tile_begin, job.tile_end);   /* memory stays per band */
+
+            accum_resolve(&acc, image_stream_acquire(&stream));
+            rc = image_stream_submit(&stream, acc.rows);
+        }
+        if (image_stream_close(&stream) != 0)
+            rc = -1;
+    }
+    if (opts->output && fclose(f) != 0)
+        rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", opts->output ? opts->output : "image");
+        if (opts->output)
+            remove(opts->output);
+    }
+    visibility_finish(&vis);
+    accum_free(&acc);
+    return rc;
+}
+#endif
+
+/* --connect: has a render daemon produce the image and writes it like a local render */
+static int render_remote(const render_options *opts) {
+    daemon_request req;
+    memset(&req, 0, sizeof(req));
+    req.magic = DAEMON_MAGIC;
+    req.version = DAEMON_VERSION;
+    snprintf(req.scene_name, sizeof(req.scene_name), "%s", opts->scene_name);
+    req.view = world_view(opts, 0.0);
+    req.width = opts->width;
+    req.height = opts->height;
+    req.crop_x = opts->crop_x;
+    req.crop_y = opts->crop_y;
+    req.crop_width = opts->crop_width ? opts->crop_width : opts->width;
+    req.crop_height = opts->crop_width ? opts->crop_height : opts->height;
+    req.samples = opts->samples;
+    req.max_depth = opts->max_depth;
+    req.priority = opts->priority;
+    req.seed = opts->seed;
+
+    daemon_reply rep;
+    unsigned char *pixels;
+    if (daemon_request_image(opts->connect_socket, &req, &rep, &pixels) != 0)
+        return -1;
+    fprintf(stderr, "Daemon rendered %dx%d in %.2f seconds.\n", rep.width, rep.height, rep.seconds);
+    int rc = image_write_file(pixels, opts->output, rep.width, rep.height);
+    daemon_release_image(&rep, pixels);
+    return rc;
+}
+
+/* --emit-c: writes the scene as a compiled-scene header */
+static int emit_world(const render_options *opts) {
+#ifdef SCENE_COMPILED
+    (void)opts;
+    fprintf(stderr, "Error: --emit-c needs the generic build (this one has '%s' compiled in)\n", COMPILED_SCENE_NAME);
+    return -1;
 #else
-    /* Single frame render */
-    build_scene(0.0);
+    if (build_world(opts, 0.0) != 0)
+        return -1;
+    FILE *f = fopen(opts->emit_c, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Failed to open %s\n", opts->emit_c);
+        return -1;
+    }
+    int rc = scene_emit_c(&world, opts->scene_name, f);
+    if (fclose(f) != 0)
+        rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", opts->emit_c);
+        remove(opts->emit_c);   /* never leave a truncated header for make to pick up */
+        return -1;
+    }
+    fprintf(stderr, "Wrote scene '%s' to %s.\n", opts->scene_name, opts->emit_c);
+    return 0;
+#endif
+}
 
-    vec3 lookfrom = vec3_create(13, 2, 3);
-    vec3 lookat = vec3_create(0, 0, 0);
-    vec3 vup = vec3_create(0, 1, 0);
-    double dist_to_focus = 10.0;
-    double aperture = 0.1;
+int main(int argc, char **argv) {
+    render_options opts = {
+        .width = IMAGE_WIDTH,
+        .samples = SAMPLES_PER_PIXEL,
+        .max_depth = MAX_DEPTH,
+        .threads = NUM_THREADS,
+        .tile_begin = 0, .tile_end = -1,
+        .sample_begin = 0, .sample_end = -1,
+        .frame_begin = 0, .frame_end = -1,
+#ifdef SCENE_COMPILED
+        .scene_name = COMPILED_SCENE_NAME,
+#else
+        .scene_name = "demo",
+#endif
+        .prims = 100000,
+        .triangle_percent = 25,
+        .cache_error = 0.1,
+        .cache_entries = 1 << 20,
+    };
+    if (options_parse(&opts, argc, argv) != 0)
+        return 1;
 
-    cam = camera_create(lookfrom, lookat, vup, 20.0, ASPECT_RATIO, aperture, dist_to_focus);
+    if (opts.height == 0)
+        opts.height = (int)(opts.width / ASPECT_RATIO);
+    if (!opts.seed_set)
+        opts.seed = (unsigned int)time(NULL);
 
-    fprintf(stderr, "Rendering %dx%d image with %d samples/pixel, %d threads...\n",
-            IMAGE_WIDTH, IMAGE_HEIGHT, SAMPLES_PER_PIXEL, NUM_THREADS);
+    int num_tiles = render_tile_count(opts.width, opts.height);
+    if (opts.tile_end < 0) opts.tile_end = num_tiles;
+    if (opts.sample_end < 0) opts.sample_end = opts.samples;
+    if (opts.frame_end < 0) opts.frame_end = TOTAL_FRAMES;
+    if (opts.tile_end > num_tiles || opts.tile_begin >= opts.tile_end) {
+        fprintf(stderr, "Error: tile range %d:%d outside 0:%d\n", opts.tile_begin, opts.tile_end, num_tiles);
+        return 1;
+    }
+    if (opts.sample_end > opts.samples || opts.sample_begin >= opts.sample_end) {
+        fprintf(stderr, "Error: sample range %d:%d outside 0:%d\n", opts.sample_begin, opts.sample_end, opts.samples);
+        return 1;
+    }
+    if (opts.frame_end > TOTAL_FRAMES || opts.frame_begin >= opts.frame_end) {
+        fprintf(stderr, "Error: frame range %d:%d outside 0:%d\n", opts.frame_begin, opts.frame_end, TOTAL_FRAMES);
+        return 1;
+    }
+    if (opts.preview && (!opts.output || opts.partial || ENABLE_ANIMATION)) {
+        fprintf(stderr, "Error: --preview refines a single image in place and needs -o FILE\n");
+        return 1;
+    }
+    if (!opts.partial && (opts.tile_begin > 0 || opts.tile_end < num_tiles)) {
+        fprintf(stderr, "Error: --tiles needs --partial (combine shards with merge)\n");
+        return 1;
+    }
 
-    struct timespec start_time, end_time;
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    int served = opts.daemon_socket || opts.connect_socket;
+    if (served && (opts.partial || opts.preview || opts.budget > 0.0 || opts.stream || opts.guide_cell > 0.0
+                   || opts.sample_begin > 0 || opts.sample_end < opts.samples)) {
+        fprintf(stderr, "Error: --daemon and --connect render whole images (no sharding, --budget, --preview, "
+                        "--stream or --guide)\n");
+        return 1;
+    }
+    if (opts.daemon_socket && opts.connect_socket) {
+        fprintf(stderr, "Error: use either --daemon or --connect\n");
+        return 1;
+    }
+    if ((opts.crop_width || opts.priority) && !opts.connect_socket) {
+        fprintf(stderr, "Error: --crop and --priority apply to daemon requests (--connect)\n");
+        return 1;
+    }
+    if (opts.crop_width && (opts.crop_x + opts.crop_width > opts.width || opts.crop_y + opts.crop_height > opts.height)) {
+        fprintf(stderr, "Error: crop region outside the %dx%d image\n", opts.width, opts.height);
+        return 1;
+    }
 
-    pthread_t threads[NUM_THREADS];
-    thread_data tdata[NUM_THREADS];
-    int rows_per_thread = IMAGE_HEIGHT / NUM_THREADS;
+    if (opts.incremental && (served || opts.partial || opts.preview || opts.budget > 0.0 || opts.stream
+                             || opts.cache_cell > 0.0 || opts.guide_cell > 0.0 || ENABLE_ANIMATION
+                             || opts.sample_begin > 0 || opts.sample_end < opts.samples)) {
+        fprintf(stderr, "Error: --incremental renders whole still images (no sharding, daemon, --budget, "
+                        "--preview, --radiance-cache, --guide or animation)\n");
+        return 1;
+    }
 
-    for (int t = 0; t < NUM_THREADS; t++) {
-        tdata[t].start_row = t * rows_per_thread;
-        tdata[t].end_row = (t == NUM_THREADS - 1) ? IMAGE_HEIGHT : (t + 1) * rows_per_thread;
-        tdata[t].seed = (unsigned int)(time(NULL) + t);
-        pthread_create(&threads[t], NULL, render_thread, &tdata[t]);
+    if (opts.visibility && (served || opts.emit_c)) {
+        fprintf(stderr, "Error: --visibility applies to local renders (no --daemon, --connect or --emit-c)\n");
+        return 1;
     }
+#ifdef SCENE_COMPILED
+    if (opts.visibility) {
+        /* Its candidate lists index the generic scene's BVH, which compiled scenes do not have */
+        fprintf(stderr, "Error: --visibility needs the generic build\n");
+        return 1;
+    }
+#endif
 
-    for (int t = 0; t < NUM_THREADS; t++) {
-        pthread_join(threads[t], NULL);
+    if (opts.publish && (served || opts.emit_c)) {
+        fprintf(stderr, "Error: --publish applies to local renders (no --daemon, --connect or --emit-c)\n");
+        return 1;
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &end_time);
-    double elapsed = (end_time.tv_sec - start_time.tv_sec)
-                   + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
-    fprintf(stderr, "Render complete in %.2f seconds.\n", elapsed);
+    if (opts.mem_budget > 0.0 && (served || opts.partial || opts.preview || opts.budget > 0.0 || opts.stream
+                                  || opts.incremental || opts.guide_cell > 0.0 || opts.publish
+                                  || ENABLE_ANIMATION || opts.sample_begin > 0 || opts.sample_end < opts.samples)) {
+        fprintf(stderr, "Error: --mem-budget streams whole still images (no sharding, daemon, --budget, "
+                        "--preview, --incremental, --guide, --publish or animation)\n");
+        return 1;
+    }
+
+    if (opts.connect_socket)
+        return render_remote(&opts) == 0 ? 0 : 1;
+    if (opts.emit_c)
+        return emit_world(&opts) == 0 ? 0 : 1;
+    if (opts.cache_cell > 0.0
+        && radcache_create(&world_cache, opts.cache_cell, opts.cache_error, (uint64_t)opts.cache_entries) != 0) {
+        fprintf(stderr, "Error: Failed to allocate radiance cache\n");
+        return 1;
+    }
+    if (opts.guide_cell > 0.0 && guide_create(&world_guide, opts.guide_cell) != 0) {
+        fprintf(stderr, "Error: Failed to allocate path guide\n");
+        return 1;
+    }
+    if (opts.publish) {
+        if (shmfb_create(&world_fb, opts.publish, opts.width, opts.height, TILE_SIZE, opts.threads) != 0)
+            return 1;
+        atexit(unpublish);
+    }
+    if (opts.daemon_socket) {
+        /* Requests bring their own camera; the scene is built once for all of them */
+        if (build_world(&opts, 0.0) != 0)
+            return 1;
+        return daemon_serve(&world, opts.cache_cell > 0.0 ? &world_cache : NULL, opts.scene_name,
+                            opts.daemon_socket, opts.threads) == 0 ? 0 : 1;
+    }
 
-    printf("P3\n%d %d\n255\n", IMAGE_WIDTH, IMAGE_HEIGHT);
-    for (int j = 0; j < IMAGE_HEIGHT; j++) {
-        for (int i = 0; i < IMAGE_WIDTH; i++) {
-            int idx = (j * IMAGE_WIDTH + i) * 3;
-            printf("%d %d %d\n", image_buffer[idx], image_buffer[idx + 1], image_buffer[idx + 2]);
+    video_format stream_format = VIDEO_Y4M;
+    if (opts.stream) {
+        if (!strcmp(opts.stream, "y4m")) {
+            stream_format = VIDEO_Y4M;
+        } else if (!strcmp(opts.stream, "rgb")) {
+            stream_format = VIDEO_RGB24;
+        } else {
+            fprintf(stderr, "Error: unknown stream format '%s' (y4m, rgb)\n", opts.stream);
+            return 1;
+        }
+        if (!ENABLE_ANIMATION || opts.partial) {
+            fprintf(stderr, "Error: --stream writes whole animation frames (raytracer_anim, no --partial)\n");
+            return 1;
         }
     }
+
+    double aspect = (double)opts.width / opts.height;
+
+#if ENABLE_ANIMATION
+    fprintf(stderr, "Rendering frames %d-%d of %d frame animation (%dx%d, samples %d-%d of %d, %d threads)...\n",
+            opts.frame_begin, opts.frame_end - 1, TOTAL_FRAMES, opts.width, opts.height,
+            opts.sample_begin, opts.sample_end - 1, opts.samples, opts.threads);
+
+    /* Frames go to an encoder pipe instead of files; conversion runs on the writer thread */
+    video_stream video;
+    FILE *video_out = stdout;
+    if (opts.stream) {
+        if (opts.output && !(video_out = fopen(opts.output, "wb"))) {
+            fprintf(stderr, "Error: Failed to open %s\n", opts.output);
+            return 1;
+        }
+        if (video_open(&video, video_out, stream_format, opts.width, opts.height, FPS) != 0)
+            return 1;
+    }
+
+    for (int frame = opts.frame_begin; frame < opts.frame_end; frame++) {
+        double frame_time = (double)frame / FPS;
+        
+        /* Build scene and camera for this frame */
+        if (build_world(&opts, frame_time) != 0)
+            return 1;
+        camera cam = world_camera(&opts, frame_time, aspect);
+        if (opts.cache_cell > 0.0)
+            radcache_clear(&world_cache);   /* cached light belongs to the previous frame's scene */
+        if (opts.guide_cell > 0.0)
+            guide_clear(&world_guide);
+
+        /* Multi-threaded rendering for this frame */
+        double start_time = render_clock();
+
+        accum_buffer acc;
+        if (render_frame(&opts, cam, frame, &acc) != 0)
+            return 1;
+
+        double elapsed = render_clock() - start_time;
+
+        /* Write the frame, or this shard's accumulation for it */
+        char filename[512];
+        int rc;
+        if (opts.stream) {
+            accum_resolve(&acc, video_acquire(&video));
+            rc = video_submit(&video);
+            if (rc != 0)
+                fprintf(stderr, "Error: Failed to write video stream\n");
+        } else if (opts.partial) {
+            snprintf(filename, sizeof(filename), "%s_%04d.acc", opts.partial, frame);
+            rc = accum_save(&acc, filename);
+        } else {
+            snprintf(filename, sizeof(filename), "frame_%04d.ppm", frame);
+            rc = write_image(&acc, filename, acc.width, acc.rows);
+        }
+        accum_free(&acc);
+        if (rc != 0)
+            return 1;
+
+        fprintf(stderr, "Frame %d/%d complete in %.2f seconds.\n", frame + 1, TOTAL_FRAMES, elapsed);
+    }
+
+    if (opts.publish)
+        shmfb_finish(&world_fb);
+
+    if (opts.stream) {
+        int rc = video_close(&video);
+        if (video_out != stdout)
+            fclose(video_out);
+        if (rc != 0) {
+            fprintf(stderr, "Error: Failed to write video stream\n");
+            return 1;
+        }
+    }
+
+#else
+    (void)stream_format;  /* streaming is rejected above without animation */
+
+    /* Single frame render */
+    if (build_world(&opts, 0.0) != 0)
+        return 1;
+    camera cam = world_camera(&opts, 0.0, aspect);
+
+    fprintf(stderr, "Rendering %dx%d image with %d samples/pixel, %d threads...\n",
+            opts.width, opts.height, opts.samples, opts.threads);
+    if (opts.partial)
+        fprintf(stderr, "Shard: tiles %d-%d of %d, samples %d-%d\n",
+                opts.tile_begin, opts.tile_end - 1, num_tiles, opts.sample_begin, opts.sample_end - 1);
+
+    double start_time = render_clock();
+
+    if (opts.mem_budget > 0.0) {
+        /* Bands are written as they finish; there is no whole-image buffer to write afterwards */
+        if (render_streamed(&opts, cam) != 0)
+            return 1;
+        fprintf(stderr, "Render complete in %.2f seconds.\n", render_clock() - start_time);
+        fprintf(stderr, "Done.\n");
+        return 0;
+    }
+
+    accum_buffer acc;
+    int rendered = opts.incremental ? render_incremental(&opts, cam, &acc) : render_frame(&opts, cam, 0, &acc);
+    if (rendered != 0)
+        return 1;
+
+    fprintf(stderr, "Render complete in %.2f seconds.\n", render_clock() - start_time);
+    if (opts.publish)
+        shmfb_finish(&world_fb);
+    if (opts.cache_cell > 0.0) {
+        uint64_t used, converged;
+        radcache_stats(&world_cache, &used, &converged);
+        fprintf(stderr, "Radiance cache: %llu of %llu entries used, %llu converged.\n",
+                (unsigned long long)used, (unsigned long long)(world_cache.mask + 1),
+                (unsigned long long)converged);
+    }
+
+    int rc;
+    if (opts.partial) {
+        char filename[512];
+        snprintf(filename, sizeof(filename), "%s.acc", opts.partial);
+        rc = accum_save(&acc, filename);
+    } else {
+        rc = write_image(&acc, opts.output, acc.width, acc.rows);
+    }
+    accum_free(&acc);
+    if (rc != 0)
+        return 1;
 #endif
 
-    free(image_buffer);
     fprintf(stderr, "Done.\n");
     return 0;
 }
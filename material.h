@@ -1,6 +1,8 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <stdint.h>
+
 #include "vec3.h"
 #include "ray.h"
 #include "texture.h"
@@ -24,6 +26,7 @@ typedef struct {
     double t;
     int front_face;
     material mat;
+    uint32_t prim;      /* scene-wide id of the primitive hit (scene_prim_id) */
 } hit_record;
 
 static inline void set_face_normal(hit_record *rec, ray r, vec3 outward_normal) {
@@ -38,9 +41,24 @@ static inline double reflectance(double cosine, double ref_idx) {
     return r0 + (1.0 - r0) * pow((1.0 - cosine), 5.0);
 }
 
+/*
+ * A compiled scene (see emit.h) sets these to 0 for material types it never
+ * uses, which removes their cases from material_scatter.
+ */
+#ifndef SCENE_USES_LAMBERTIAN
+#define SCENE_USES_LAMBERTIAN 1
+#endif
+#ifndef SCENE_USES_METAL
+#define SCENE_USES_METAL 1
+#endif
+#ifndef SCENE_USES_DIELECTRIC
+#define SCENE_USES_DIELECTRIC 1
+#endif
+
 static inline int material_scatter(material mat, ray r_in, hit_record *rec,
                                     vec3 *attenuation, ray *scattered) {
     switch (mat.type) {
+#if SCENE_USES_LAMBERTIAN
         case MAT_LAMBERTIAN: {
             vec3 scatter_dir = vec3_add(rec->normal, random_unit_vector());
             if (vec3_near_zero(scatter_dir))
@@ -49,12 +67,16 @@ static inline int material_scatter(material mat, ray r_in, hit_record *rec,
             *attenuation = texture_value(mat.tex, rec->p);
             return 1;
         }
+#endif
+#if SCENE_USES_METAL
         case MAT_METAL: {
             vec3 reflected = vec3_reflect(vec3_unit(r_in.direction), rec->normal);
             *scattered = ray_create(rec->p, vec3_add(reflected, vec3_scale(random_in_unit_sphere(), mat.fuzz)));
             *attenuation = texture_value(mat.tex, rec->p);
             return (vec3_dot(scattered->direction, rec->normal) > 0);
         }
+#endif
+#if SCENE_USES_DIELECTRIC
         case MAT_DIELECTRIC: {
             *attenuation = vec3_create(1.0, 1.0, 1.0);
             double refraction_ratio = rec->front_face ? (1.0 / mat.ref_idx) : mat.ref_idx;
@@ -70,6 +92,9 @@ static inline int material_scatter(material mat, ray r_in, hit_record *rec,
             *scattered = ray_create(rec->p, direction);
             return 1;
         }
+#endif
+        default:
+            break;
     }
     return 0;
 }
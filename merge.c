@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec3.h"
+#include "color.h"
+#include "accum.h"
+#include "imagefile.h"
+
+/*
+ * Combines partial accumulation files written by `raytracer --partial` into
+ * the final image. Shards may split a frame by tiles, by samples, or both;
+ * their sums and sample counts simply add up. Each file lists the tiles and
+ * samples it holds, and a shard repeating work already merged is refused.
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-o out.ppm] [-a out.acc] shard.acc...\n"
+        "  -o FILE  write the resolved image to FILE, PNG if it ends in .png (default: PPM to stdout)\n"
+        "  -a FILE  also write the merged accumulation, for merging in stages\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    const char *out_image = NULL;
+    const char *out_acc = NULL;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-o") && first + 1 < argc) {
+            out_image = argv[first + 1];
+        } else if (!strcmp(argv[first], "-a") && first + 1 < argc) {
+            out_acc = argv[first + 1];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        first += 2;
+    }
+    if (first >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    accum_buffer total = {0};
+    int have_total = 0;
+
+    for (int i = first; i < argc; i++) {
+        accum_buffer shard;
+        if (accum_load(&shard, argv[i]) != 0) {
+            if (have_total)
+                accum_free(&total);
+            return 1;
+        }
+        if (!have_total) {
+            if (accum_create(&total, shard.width, shard.height, 0, shard.height) != 0) {
+                fprintf(stderr, "Error: Failed to allocate %dx%d buffer\n", shard.width, shard.height);
+                accum_free(&shard);
+                return 1;
+            }
+            total.frame = shard.frame;
+            have_total = 1;
+        } else if (shard.width != total.width || shard.height != total.height || shard.frame != total.frame) {
+            fprintf(stderr, "Error: %s is %dx%d frame %d, expected %dx%d frame %d\n",
+                    argv[i], shard.width, shard.height, shard.frame,
+                    total.width, total.height, total.frame);
+            accum_free(&shard);
+            accum_free(&total);
+            return 1;
+        }
+        int rc = 0;
+        for (int r = 0; r < shard.num_ranges && rc == 0; r++) {
+            accum_range a = shard.ranges[r];
+            for (int q = 0; q < total.num_ranges; q++) {
+                if (accum_ranges_overlap(a, total.ranges[q])) {
+                    fprintf(stderr, "Error: %s repeats tiles %d-%d, samples %d-%d of an earlier shard\n",
+                            argv[i], a.tile_begin, a.tile_end - 1, a.sample_begin, a.sample_end - 1);
+                    rc = -1;
+                    break;
+                }
+            }
+            if (rc == 0 && accum_add_range(&total, a) != 0) {
+                fprintf(stderr, "Error: Failed to allocate shard list\n");
+                rc = -1;
+            }
+        }
+        if (rc != 0) {
+            accum_free(&shard);
+            accum_free(&total);
+            return 1;
+        }
+        accum_merge(&total, &shard);
+        accum_free(&shard);
+    }
+
+    int rc = 0;
+    if (out_acc && accum_save(&total, out_acc) != 0)
+        rc = 1;
+
+    unsigned char *image_buffer = (unsigned char *)malloc((size_t)total.width * total.height * 3);
+    if (!image_buffer) {
+        fprintf(stderr, "Error: Failed to allocate image buffer\n");
+        accum_free(&total);
+        return 1;
+    }
+    long missing = accum_resolve(&total, image_buffer);
+    if (missing > 0)
+        fprintf(stderr, "Warning: %ld of %d pixels have no samples (missing shards?)\n",
+                missing, total.width * total.height);
+
+    if ((!out_acc || out_image) && image_write_file(image_buffer, out_image, total.width, total.height) != 0)
+        rc = 1;
+
+    fprintf(stderr, "Merged %d shard(s) into %dx%d frame %d.\n",
+            argc - first, total.width, total.height, total.frame);
+    free(image_buffer);
+    accum_free(&total);
+    return rc;
+}
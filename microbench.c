@@ -0,0 +1,415 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "vec3.h"
+#include "ray.h"
+#include "material.h"
+#include "texture.h"
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "aabb.h"
+#include "bvh.h"
+
+/*
+ * Micro-benchmarks for the per-ray kernels: each kernel runs over a batch of
+ * pre-generated inputs (fixed seed, so every run and every variant sees the
+ * same data), repeatedly, and reports the median time per call with its
+ * spread. A call includes storing its result, which keeps the compiler from
+ * dropping the work.
+ *
+ * A kernel with a `reference` is a variant of that kernel (another layout, a
+ * SIMD rewrite, ...): before it is timed its results over the batch are
+ * compared with the reference's, and a mismatch fails the run. New variants
+ * are one run function and one row in `kernels`.
+ */
+#define BENCH_SEED 12345u
+#define BENCH_BATCH 65536           /* inputs per batch */
+#define BENCH_REPS 15               /* timed repetitions per kernel */
+#define BENCH_MIN_REP_SECONDS 0.05  /* a repetition loops over the batch at least this long */
+#define BENCH_TOLERANCE 1e-9        /* relative difference a variant may show */
+
+/* Inputs: element i of each array goes with element i of the others */
+typedef struct {
+    int n;
+    unsigned int seed;      /* also restarts the random numbers kernels draw */
+    ray *rays;
+    vec3 *inv_dirs;         /* reciprocal ray directions, as a BVH traversal precomputes them */
+    sphere *spheres;
+    triangle *triangles;
+    plane *planes;
+    aabb *boxes;
+    hit_record *hits;       /* surface points with the ray that reached them in rays[i] */
+    vec3 *points;           /* texture lookup positions */
+} bench_batch;
+
+/* What one call produced; variants must match their reference on every field */
+typedef struct {
+    int hit;
+    double t;
+    vec3 v;
+} bench_result;
+
+typedef void (*bench_run_fn)(const bench_batch *b, bench_result *out);
+
+typedef struct {
+    const char *name;
+    const char *reference;  /* kernel this is a variant of, NULL: none */
+    bench_run_fn run;
+} bench_kernel;
+
+static const material bench_lambertian = {MAT_LAMBERTIAN, {TEXTURE_SOLID, {0.5, 0.5, 0.5}, {0, 0, 0}, 1.0}, 0.0, 0.0};
+static const material bench_metal = {MAT_METAL, {TEXTURE_SOLID, {0.7, 0.6, 0.5}, {0, 0, 0}, 1.0}, 0.3, 0.0};
+static const material bench_dielectric = {MAT_DIELECTRIC, {TEXTURE_SOLID, {1, 1, 1}, {0, 0, 0}, 1.0}, 0.0, 1.5};
+static const texture bench_checker = {TEXTURE_CHECKER, {0.2, 0.3, 0.1}, {0.9, 0.9, 0.9}, 10.0};
+static const texture bench_perlin = {TEXTURE_PERLIN, {0.8, 0.8, 0.8}, {0.1, 0.1, 0.1}, 4.0};
+
+static void run_sphere_hit(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        hit_record rec = {0};
+        out[i].hit = sphere_hit(b->spheres[i], b->rays[i], 0.001, 1e30, &rec);
+        out[i].t = rec.t;
+        out[i].v = rec.normal;
+    }
+}
+
+static void run_triangle_hit(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        hit_record rec = {0};
+        out[i].hit = triangle_hit(b->triangles[i], b->rays[i], 0.001, 1e30, &rec);
+        out[i].t = rec.t;
+        out[i].v = rec.normal;
+    }
+}
+
+static void run_plane_hit(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        hit_record rec = {0};
+        out[i].hit = plane_hit(b->planes[i], b->rays[i], 0.001, 1e30, &rec);
+        out[i].t = rec.t;
+        out[i].v = rec.normal;
+    }
+}
+
+static void run_aabb_hit(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        out[i].hit = aabb_hit(b->boxes[i], b->rays[i], 0.001, 1e30);
+        out[i].t = 0.0;
+        out[i].v = vec3_create(0, 0, 0);
+    }
+}
+
+/* The form bvh_hit uses: reciprocal direction shared by every box a ray meets */
+static void run_aabb_hit_inv(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        double t_enter;
+        out[i].hit = aabb_hit_inv(&b->boxes[i], b->rays[i].origin, b->inv_dirs[i], 0.001, 1e30, &t_enter);
+        out[i].t = 0.0;
+        out[i].v = vec3_create(0, 0, 0);
+    }
+}
+
+/* Scattering draws random numbers: every run restarts the sequence so variants can be compared */
+static void run_scatter(const bench_batch *b, bench_result *out, material mat) {
+    tl_seed = b->seed;
+    for (int i = 0; i < b->n; i++) {
+        hit_record rec = b->hits[i];
+        vec3 attenuation = vec3_create(0, 0, 0);
+        ray scattered = {{0, 0, 0}, {0, 0, 0}};
+        out[i].hit = material_scatter(mat, b->rays[i], &rec, &attenuation, &scattered);
+        out[i].t = attenuation.x + attenuation.y + attenuation.z;
+        out[i].v = scattered.direction;
+    }
+}
+
+static void run_scatter_lambertian(const bench_batch *b, bench_result *out) {
+    run_scatter(b, out, bench_lambertian);
+}
+
+static void run_scatter_metal(const bench_batch *b, bench_result *out) {
+    run_scatter(b, out, bench_metal);
+}
+
+static void run_scatter_dielectric(const bench_batch *b, bench_result *out) {
+    run_scatter(b, out, bench_dielectric);
+}
+
+static void run_texture_checker(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        out[i].hit = 1;
+        out[i].t = 0.0;
+        out[i].v = texture_value(bench_checker, b->points[i]);
+    }
+}
+
+static void run_texture_perlin(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        out[i].hit = 1;
+        out[i].t = 0.0;
+        out[i].v = texture_value(bench_perlin, b->points[i]);
+    }
+}
+
+static void run_perlin_noise(const bench_batch *b, bench_result *out) {
+    for (int i = 0; i < b->n; i++) {
+        out[i].hit = 1;
+        out[i].t = perlin_noise(b->points[i]);
+        out[i].v = vec3_create(0, 0, 0);
+    }
+}
+
+static const bench_kernel kernels[] = {
+    {"sphere_hit", NULL, run_sphere_hit},
+    {"triangle_hit", NULL, run_triangle_hit},
+    {"plane_hit", NULL, run_plane_hit},
+    {"aabb_hit", NULL, run_aabb_hit},
+    {"aabb_hit_inv", "aabb_hit", run_aabb_hit_inv},
+    {"material_scatter/lambertian", NULL, run_scatter_lambertian},
+    {"material_scatter/metal", NULL, run_scatter_metal},
+    {"material_scatter/dielectric", NULL, run_scatter_dielectric},
+    {"texture_value/checker", NULL, run_texture_checker},
+    {"texture_value/perlin", NULL, run_texture_perlin},
+    {"perlin_noise", NULL, run_perlin_noise},
+};
+#define BENCH_NUM_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+static void batch_free(bench_batch *b) {
+    free(b->rays);
+    free(b->inv_dirs);
+    free(b->spheres);
+    free(b->triangles);
+    free(b->planes);
+    free(b->boxes);
+    free(b->hits);
+    free(b->points);
+}
+
+/*
+ * Rays start 4 to 8 units from the origin and aim near it and primitives sit
+ * around the origin, so both hits and misses are common (the hits column
+ * gives the share).
+ */
+static int batch_create(bench_batch *b, int n, unsigned int seed) {
+    memset(b, 0, sizeof(*b));
+    b->n = n;
+    b->seed = seed;
+    b->rays = (ray *)malloc(sizeof(ray) * (size_t)n);
+    b->inv_dirs = (vec3 *)malloc(sizeof(vec3) * (size_t)n);
+    b->spheres = (sphere *)malloc(sizeof(sphere) * (size_t)n);
+    b->triangles = (triangle *)malloc(sizeof(triangle) * (size_t)n);
+    b->planes = (plane *)malloc(sizeof(plane) * (size_t)n);
+    b->boxes = (aabb *)malloc(sizeof(aabb) * (size_t)n);
+    b->hits = (hit_record *)malloc(sizeof(hit_record) * (size_t)n);
+    b->points = (vec3 *)malloc(sizeof(vec3) * (size_t)n);
+    if (!b->rays || !b->inv_dirs || !b->spheres || !b->triangles || !b->planes || !b->boxes || !b->hits
+        || !b->points) {
+        batch_free(b);
+        return -1;
+    }
+
+    tl_seed = seed;
+    for (int i = 0; i < n; i++) {
+        vec3 origin = vec3_scale(random_unit_vector(), random_double_range(4.0, 8.0));
+        vec3 target = vec3_random_range(-1.0, 1.0);
+        b->rays[i] = ray_create(origin, vec3_sub(target, origin));
+        b->inv_dirs[i] = bvh_inv_dir(b->rays[i].direction);
+
+        b->spheres[i] = (sphere){vec3_random_range(-1.0, 1.0), random_double_range(0.2, 1.0), bench_lambertian};
+        b->triangles[i] = (triangle){vec3_random_range(-1.5, 1.5), vec3_random_range(-1.5, 1.5),
+                                     vec3_random_range(-1.5, 1.5), bench_lambertian};
+        b->planes[i] = (plane){vec3_random_range(-1.0, 1.0), random_unit_vector(), bench_lambertian};
+        vec3 lo = vec3_random_range(-1.0, 1.0);
+        b->boxes[i] = aabb_create(lo, vec3_add(lo, vec3_random_range(0.1, 1.0)));
+
+        hit_record rec = {0};
+        rec.p = vec3_random_range(-2.0, 2.0);
+        rec.t = random_double_range(1.0, 10.0);
+        set_face_normal(&rec, b->rays[i], random_unit_vector());
+        rec.mat = bench_lambertian;
+        b->hits[i] = rec;
+
+        b->points[i] = vec3_random_range(-10.0, 10.0);
+    }
+    return 0;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_close(double a, double b) {
+    return fabs(a - b) <= BENCH_TOLERANCE * fmax(1.0, fmax(fabs(a), fabs(b)));
+}
+
+/* Number of calls whose result differs from the reference's */
+static int bench_mismatches(const bench_result *ref, const bench_result *out, int n) {
+    int bad = 0;
+    for (int i = 0; i < n; i++) {
+        if (ref[i].hit != out[i].hit)
+            bad++;
+        else if (ref[i].hit && !(bench_close(ref[i].t, out[i].t) && bench_close(ref[i].v.x, out[i].v.x)
+                                 && bench_close(ref[i].v.y, out[i].v.y) && bench_close(ref[i].v.z, out[i].v.z)))
+            bad++;
+    }
+    return bad;
+}
+
+static const bench_kernel *bench_find(const char *name) {
+    for (int k = 0; k < BENCH_NUM_KERNELS; k++)
+        if (!strcmp(kernels[k].name, name))
+            return &kernels[k];
+    return NULL;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Times `k` and prints its row; returns 0, or -1 if it disagrees with its reference */
+static int bench_kernel_run(const bench_kernel *k, const bench_batch *b, bench_result *out, bench_result *ref,
+                            int reps) {
+    char check[32] = "-";
+    int rc = 0;
+    if (k->reference) {
+        const bench_kernel *r = bench_find(k->reference);
+        if (!r) {
+            fprintf(stderr, "Error: %s: unknown reference kernel %s\n", k->name, k->reference);
+            return -1;
+        }
+        r->run(b, ref);
+        k->run(b, out);
+        int bad = bench_mismatches(ref, out, b->n);
+        if (bad > 0) {
+            snprintf(check, sizeof(check), "FAIL (%d)", bad);
+            rc = -1;
+        } else {
+            snprintf(check, sizeof(check), "ok");
+        }
+    }
+
+    /* Loop over the batch often enough that a repetition outlasts timer noise; this also warms up */
+    long iters = 1;
+    for (;;) {
+        double start = bench_now();
+        for (long it = 0; it < iters; it++)
+            k->run(b, out);
+        if (bench_now() - start >= BENCH_MIN_REP_SECONDS)
+            break;
+        iters *= 2;
+    }
+
+    double ns[reps];
+    double sum = 0.0, sum_sq = 0.0;
+    for (int rep = 0; rep < reps; rep++) {
+        double start = bench_now();
+        for (long it = 0; it < iters; it++)
+            k->run(b, out);
+        ns[rep] = (bench_now() - start) * 1e9 / ((double)iters * b->n);
+        sum += ns[rep];
+        sum_sq += ns[rep] * ns[rep];
+    }
+    qsort(ns, (size_t)reps, sizeof(double), bench_cmp_double);
+    double median = reps % 2 ? ns[reps / 2] : 0.5 * (ns[reps / 2 - 1] + ns[reps / 2]);
+    double mean = sum / reps;
+    double stddev = sqrt(fmax(0.0, sum_sq / reps - mean * mean));
+
+    int hits = 0;
+    for (int i = 0; i < b->n; i++)
+        hits += out[i].hit != 0;
+
+    printf("%-28s %9.2f %9.2f %8.1f%% %10.2f %6.1f%%  %s\n", k->name, median, ns[0],
+           median > 0.0 ? 100.0 * stddev / median : 0.0, median > 0.0 ? 1e3 / median : 0.0,
+           100.0 * hits / b->n, check);
+    fflush(stdout);
+    return rc;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [--batch N] [--reps N] [--seed N] [KERNEL...]\n"
+        "  --batch N  inputs per batch (default %d)\n"
+        "  --reps N   timed repetitions per kernel (default %d)\n"
+        "  --seed N   seed for the inputs (default %u)\n"
+        "  KERNEL     run only kernels whose name contains one of these strings\n",
+        prog, BENCH_BATCH, BENCH_REPS, BENCH_SEED);
+}
+
+static int parse_count(const char *arg, const char *name, long *out) {
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || v < 1 || v > (1L << 30)) {
+        fprintf(stderr, "Error: invalid value '%s' for %s\n", arg, name);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    long batch = BENCH_BATCH, reps = BENCH_REPS, seed = BENCH_SEED;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-') {
+        const char *a = argv[first];
+        if (first + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        int rc;
+        if (!strcmp(a, "--batch"))      rc = parse_count(argv[first + 1], a, &batch);
+        else if (!strcmp(a, "--reps"))  rc = parse_count(argv[first + 1], a, &reps);
+        else if (!strcmp(a, "--seed"))  rc = parse_count(argv[first + 1], a, &seed);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        if (rc != 0)
+            return 1;
+        first += 2;
+    }
+
+    /* perlin_init shuffles with rand(): seed it so the permutation is fixed too */
+    srand((unsigned int)seed);
+    perlin_init();
+
+    bench_batch b;
+    bench_result *out = (bench_result *)malloc(sizeof(bench_result) * (size_t)batch);
+    bench_result *ref = (bench_result *)malloc(sizeof(bench_result) * (size_t)batch);
+    if (!out || !ref || batch_create(&b, (int)batch, (unsigned int)seed) != 0) {
+        fprintf(stderr, "Error: Failed to allocate a batch of %ld inputs\n", batch);
+        free(out);
+        free(ref);
+        return 1;
+    }
+
+    printf("Batch of %ld inputs, seed %ld, median of %ld repetitions\n", batch, seed, reps);
+    printf("%-28s %9s %9s %9s %10s %7s  %s\n", "kernel", "ns/op", "min ns", "stddev", "Mops/s", "hits", "check");
+    int failed = 0, ran = 0;
+    for (int k = 0; k < BENCH_NUM_KERNELS; k++) {
+        int selected = first == argc;
+        for (int f = first; f < argc; f++)
+            if (strstr(kernels[k].name, argv[f]))
+                selected = 1;
+        if (!selected)
+            continue;
+        ran++;
+        if (bench_kernel_run(&kernels[k], &b, out, ref, (int)reps) != 0)
+            failed++;
+    }
+    if (ran == 0)
+        fprintf(stderr, "Error: no kernel matches\n");
+    else if (failed > 0)
+        fprintf(stderr, "Error: %d kernel(s) disagree with their reference\n", failed);
+
+    batch_free(&b);
+    free(out);
+    free(ref);
+    return ran > 0 && failed == 0 ? 0 : 1;
+}
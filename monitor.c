@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "vec3.h"
+#include "color.h"
+#include "accum.h"
+#include "shmfb.h"
+#include "imagefile.h"
+
+/*
+ * Watches a render started with `raytracer --publish NAME`: prints its
+ * progress and throughput from the shared framebuffer and can write a
+ * snapshot of the image so far, without disturbing the render.
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [--watch SECONDS] [-o out.ppm] NAME\n"
+        "  --watch SECONDS  report (and rewrite the snapshot) every SECONDS until the render ends\n"
+        "  -o FILE          write a snapshot of the image so far to FILE\n",
+        prog);
+}
+
+/* Reads every tile into `acc`; returns the number of tiles that stayed busy */
+static int snapshot(const shmfb *fb, accum_buffer *acc, uint32_t *min_spp, uint32_t *max_spp) {
+    int num_tiles = fb->header->tiles_x * fb->header->tiles_y;
+    int busy = 0;
+    *min_spp = UINT32_MAX;
+    *max_spp = 0;
+    for (int t = 0; t < num_tiles; t++) {
+        shmfb_tile tile;
+        if (shmfb_read_tile(fb, t, acc, &tile) != 0) {
+            busy++;
+            continue;
+        }
+        if (tile.samples < *min_spp) *min_spp = tile.samples;
+        if (tile.samples > *max_spp) *max_spp = tile.samples;
+    }
+    if (*min_spp > *max_spp)
+        *min_spp = 0;
+    return busy;
+}
+
+static int write_snapshot(const accum_buffer *acc, const char *path) {
+    unsigned char *image_buffer = (unsigned char *)malloc((size_t)acc->width * acc->height * 3);
+    if (!image_buffer) {
+        fprintf(stderr, "Error: Failed to allocate image buffer\n");
+        return -1;
+    }
+    accum_resolve(acc, image_buffer);
+    int rc = image_write_file(image_buffer, path, acc->width, acc->height);
+    free(image_buffer);
+    return rc;
+}
+
+static void report(const shmfb *fb, uint32_t min_spp, uint32_t max_spp) {
+    const shmfb_header *h = fb->header;
+    int done = atomic_load(&h->state) == SHMFB_DONE;
+    uint64_t start = atomic_load(&h->start_ns);
+    uint64_t now = done ? atomic_load(&h->update_ns) : shmfb_now_ns();
+    uint64_t samples = atomic_load(&h->samples);
+    uint64_t target = atomic_load(&h->target);
+    uint64_t busy = atomic_load(&h->busy_ns);
+    double elapsed = (now - start) / 1e9;
+    double rate = elapsed > 0.0 ? samples / elapsed : 0.0;
+
+    printf("frame %d %s: %.1f%% (%llu of %llu samples), tiles at %u-%u spp, %llu tile passes\n",
+           atomic_load(&h->frame), done ? "done" : "rendering",
+           target ? 100.0 * samples / target : 100.0,
+           (unsigned long long)samples, (unsigned long long)target, min_spp, max_spp,
+           (unsigned long long)atomic_load(&h->tile_passes));
+    printf("  %.2f s elapsed, %.2f Msamples/s (%.2f per busy thread), %d threads",
+           elapsed, rate / 1e6, busy ? samples / (busy / 1e9) / 1e6 : 0.0, h->threads);
+    if (!done && rate > 0.0 && target > samples)
+        printf(", %.0f s to go", (target - samples) / rate);
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *out_image = NULL;
+    double interval = 0.0;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-o") && first + 1 < argc) {
+            out_image = argv[first + 1];
+        } else if (!strcmp(argv[first], "--watch") && first + 1 < argc) {
+            char *end;
+            interval = strtod(argv[first + 1], &end);
+            if (*end != '\0' || !(interval > 0.0)) {
+                fprintf(stderr, "Error: invalid value '%s' for --watch\n", argv[first + 1]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        first += 2;
+    }
+    if (first + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    shmfb fb;
+    if (shmfb_open(&fb, argv[first]) != 0)
+        return 1;
+    printf("%s: %dx%d image in %dx%d tiles, rendered by process %d\n", fb.name,
+           fb.header->width, fb.header->height, fb.header->tiles_x, fb.header->tiles_y, fb.header->pid);
+
+    accum_buffer acc;
+    if (accum_create(&acc, fb.header->width, fb.header->height, 0, fb.header->height) != 0) {
+        fprintf(stderr, "Error: Failed to allocate %dx%d buffer\n", fb.header->width, fb.header->height);
+        shmfb_close(&fb);
+        return 1;
+    }
+
+    int rc = 0;
+    for (;;) {
+        /* Read the state first: a render that was done before the snapshot stays complete in it */
+        int done = atomic_load(&fb.header->state) == SHMFB_DONE;
+        uint32_t min_spp, max_spp;
+        int busy = snapshot(&fb, &acc, &min_spp, &max_spp);
+        report(&fb, min_spp, max_spp);
+        if (busy > 0)
+            fprintf(stderr, "Warning: %d tiles stayed busy and were skipped\n", busy);
+        if (out_image && write_snapshot(&acc, out_image) != 0) {
+            rc = 1;
+            break;
+        }
+        if (interval <= 0.0 || done)
+            break;
+        if (kill(fb.header->pid, 0) != 0 && errno == ESRCH) {
+            fprintf(stderr, "Error: the render (process %d) exited before finishing\n", fb.header->pid);
+            rc = 1;
+            break;
+        }
+
+        struct timespec ts = {(time_t)interval, (long)((interval - (time_t)interval) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+
+    accum_free(&acc);
+    shmfb_close(&fb);
+    return rc;
+}
@@ -0,0 +1,276 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/* Command-line settings. Fields left at 0 / -1 / NULL mean "use the default". */
+typedef struct {
+    int width;
+    int height;             /* 0: derive from width and aspect ratio */
+    int samples;            /* samples per pixel for the whole job */
+    int max_depth;
+    int threads;
+    unsigned int seed;      /* base seed for the render threads */
+    int seed_set;
+    const char *output;     /* NULL: write to stdout */
+    const char *stream;     /* "y4m" or "rgb": stream frames to output instead of files */
+    const char *scene_name; /* scene to build: "demo", "forest", "stress" or "skylight" */
+    int prims;              /* stress scene: primitive count */
+    const char *distribution;   /* stress scene: uniform, clustered or layer */
+    int triangle_percent;   /* stress scene: share of triangles */
+    double budget;          /* wall-clock seconds per frame, 0: unlimited */
+    int preview;            /* progressive low-res-first refinement into output */
+    double cache_cell;      /* radiance cache cell size, 0: no cache */
+    double cache_error;     /* radiance cache relative error bound */
+    int cache_entries;      /* radiance cache size bound */
+    double guide_cell;      /* path guiding cell size, 0: no guiding */
+    int visibility;         /* camera rays test per-quad candidate lists (visibility.h) */
+
+    /* Camera overrides */
+    double lookfrom[3], lookat[3];
+    int lookfrom_set, lookat_set;
+    double fov;             /* vertical field of view in degrees, 0: scene default */
+
+    /* Render daemon: serve requests on a Unix socket, or send this render to one */
+    const char *daemon_socket;
+    const char *connect_socket;
+    int crop_x, crop_y, crop_width, crop_height;    /* crop_width 0: whole image */
+    int priority;           /* higher-priority requests take workers first */
+
+    const char *emit_c;     /* write the scene out as a compiled-scene header and exit */
+    const char *incremental;    /* state file: re-render only what a scene edit changed */
+    const char *publish;    /* shared memory framebuffer name for live monitoring */
+    double mem_budget;      /* MB for rendering and writing in bands, 0: whole image at once */
+
+    /* Sharding: each range is [begin, end), -1 end means "to the last one" */
+    int tile_begin, tile_end;
+    int sample_begin, sample_end;
+    int frame_begin, frame_end;
+    const char *partial;    /* write an accumulation file instead of an image */
+} render_options;
+
+static inline void options_usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --width N          image width in pixels\n"
+        "  --height N         image height (default: width / aspect ratio)\n"
+        "  --spp N            samples per pixel\n"
+        "  --depth N          maximum ray bounce depth\n"
+        "  --threads N        render threads\n"
+        "  --seed N           base random seed for the render threads\n"
+        "  -o, --output FILE  write the image to FILE instead of stdout\n"
+        "  --stream FORMAT    stream frames as y4m or rgb (raw RGB24) to -o FILE or stdout\n"
+        "  --scene NAME       demo (default), forest (10k instanced 100k-triangle shrubs)\n"
+        "                     stress (generated, see below) or skylight (room lit through\n"
+        "                     a ceiling opening)\n"
+        "  --prims N          stress scene: number of primitives (default 100000)\n"
+        "  --dist NAME        stress scene: uniform, clustered or layer\n"
+        "  --triangles PCT    stress scene: percentage of triangles (default 25)\n"
+        "  --budget SECONDS   render progressively and stop when the time is up\n"
+        "  --preview          write a coarse image at once and refine it in place (needs -o)\n"
+        "  --radiance-cache CELL\n"
+        "                     cache diffuse indirect light in world-space cells of size CELL\n"
+        "  --cache-error E    relative error a cache entry must reach before use (default 0.1)\n"
+        "  --cache-entries N  radiance cache size bound (default 1048576, 48 bytes each)\n"
+        "  --guide CELL       learn where light comes from in world-space cells of size CELL\n"
+        "                     and aim diffuse bounces there (renders in progressive passes)\n"
+        "  --visibility       list the primitives each pixel quad can see once, and test only\n"
+        "                     those for its camera rays\n"
+        "  --lookfrom X,Y,Z   camera position (default: the scene's camera)\n"
+        "  --lookat X,Y,Z     point the camera looks at\n"
+        "  --fov DEGREES      vertical field of view\n"
+        "  --incremental FILE after a scene edit, re-render only the tiles it affects; FILE\n"
+        "                     keeps the image and what each tile saw (created if missing)\n"
+        "  --mem-budget MB    render in bands of tile rows within MB of buffers and write\n"
+        "                     each to the output as it finishes (for very large images)\n"
+        "  --publish NAME     keep the image in progress in shared memory object NAME for\n"
+        "                     viewers such as `monitor` (removed when the render exits)\n"
+        "Render daemon:\n"
+        "  --daemon SOCKET    build the scene once and serve render requests on SOCKET\n"
+        "  --connect SOCKET   have the daemon on SOCKET render this image\n"
+        "  --crop X,Y,W,H     with --connect: render only this region of the image\n"
+        "  --priority N       with --connect: higher runs first (default 0)\n"
+        "Scene compiler:\n"
+        "  --emit-c FILE      write the scene as a C header for a specialized build\n"
+        "                     (make compiled) and exit\n"
+        "Sharding:\n"
+        "  --tiles A:B        render only tiles A..B-1 (row-major order)\n"
+        "  --samples A:B      render only samples A..B-1 of every pixel\n"
+        "  --frames A:B       render only frames A..B-1 (animation build)\n"
+        "  --partial PREFIX   write PREFIX.acc (PREFIX_NNNN.acc per frame) for `merge`\n",
+        prog);
+}
+
+static inline int options_parse_int(const char *arg, const char *name, int min, int *out) {
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || v < min || v > INT_MAX) {
+        fprintf(stderr, "Error: invalid value '%s' for %s\n", arg, name);
+        return -1;
+    }
+    *out = (int)v;
+    return 0;
+}
+
+static inline int options_parse_double(const char *arg, const char *name, double *out) {
+    char *end;
+    double v = strtod(arg, &end);
+    if (*arg == '\0' || *end != '\0' || !(v > 0.0)) {
+        fprintf(stderr, "Error: invalid value '%s' for %s\n", arg, name);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+/* Parses exactly `n` comma-separated numbers, e.g. "1,2.5,-3" */
+static inline int options_parse_list(const char *arg, const char *name, double *out, int n) {
+    const char *p = arg;
+    for (int k = 0; k < n; k++) {
+        char *end;
+        out[k] = strtod(p, &end);
+        if (end == p || *end != (k + 1 < n ? ',' : '\0')) {
+            fprintf(stderr, "Error: invalid value '%s' for %s (expected %d comma-separated numbers)\n",
+                    arg, name, n);
+            return -1;
+        }
+        p = end + 1;
+    }
+    return 0;
+}
+
+/* Parses "X,Y,W,H" with X, Y >= 0 and W, H >= 1 */
+static inline int options_parse_crop(const char *arg, const char *name, render_options *o) {
+    double v[4];
+    if (options_parse_list(arg, name, v, 4) != 0)
+        return -1;
+    for (int k = 0; k < 4; k++) {
+        if (v[k] < (k < 2 ? 0 : 1) || v[k] > INT_MAX || v[k] != (int)v[k]) {
+            fprintf(stderr, "Error: invalid region '%s' for %s (expected X,Y,W,H)\n", arg, name);
+            return -1;
+        }
+    }
+    o->crop_x = (int)v[0];
+    o->crop_y = (int)v[1];
+    o->crop_width = (int)v[2];
+    o->crop_height = (int)v[3];
+    return 0;
+}
+
+/* Parses "A:B" or "A:" into [begin, end); a missing end is stored as -1. */
+static inline int options_parse_range(const char *arg, const char *name, int *begin, int *end) {
+    char *sep;
+    long a = strtol(arg, &sep, 10);
+    if (sep == arg || *sep != ':' || a < 0 || a > INT_MAX) {
+        fprintf(stderr, "Error: invalid range '%s' for %s (expected A:B)\n", arg, name);
+        return -1;
+    }
+    const char *rest = sep + 1;
+    long b = -1;
+    if (*rest != '\0') {
+        char *stop;
+        b = strtol(rest, &stop, 10);
+        if (*stop != '\0' || b <= a || b > INT_MAX) {
+            fprintf(stderr, "Error: invalid range '%s' for %s (expected A:B with A < B)\n", arg, name);
+            return -1;
+        }
+    }
+    *begin = (int)a;
+    *end = (int)b;
+    return 0;
+}
+
+/* Returns 0 on success, -1 on a bad command line (after printing why). */
+static inline int options_parse(render_options *o, int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int rc = 0;
+
+        if (!strcmp(a, "-h") || !strcmp(a, "--help")) {
+            options_usage(argv[0]);
+            return -1;
+        }
+
+        /* Flags without a value */
+        if (!strcmp(a, "--preview")) {
+            o->preview = 1;
+            continue;
+        }
+        if (!strcmp(a, "--visibility")) {
+            o->visibility = 1;
+            continue;
+        }
+
+        if (!v) {
+            fprintf(stderr, "Error: unknown or incomplete option '%s'\n", a);
+            options_usage(argv[0]);
+            return -1;
+        }
+
+        if (!strcmp(a, "--width"))            rc = options_parse_int(v, a, 1, &o->width);
+        else if (!strcmp(a, "--height"))      rc = options_parse_int(v, a, 1, &o->height);
+        else if (!strcmp(a, "--spp"))         rc = options_parse_int(v, a, 1, &o->samples);
+        else if (!strcmp(a, "--depth"))       rc = options_parse_int(v, a, 1, &o->max_depth);
+        else if (!strcmp(a, "--threads"))     rc = options_parse_int(v, a, 1, &o->threads);
+        else if (!strcmp(a, "--seed")) {
+            int s;
+            rc = options_parse_int(v, a, 0, &s);
+            o->seed = (unsigned int)s;
+            o->seed_set = 1;
+        }
+        else if (!strcmp(a, "-o") || !strcmp(a, "--output")) o->output = v;
+        else if (!strcmp(a, "--scene"))       o->scene_name = v;
+        else if (!strcmp(a, "--stream"))      o->stream = v;
+        else if (!strcmp(a, "--prims"))       rc = options_parse_int(v, a, 0, &o->prims);
+        else if (!strcmp(a, "--dist"))        o->distribution = v;
+        else if (!strcmp(a, "--triangles")) {
+            rc = options_parse_int(v, a, 0, &o->triangle_percent);
+            if (rc == 0 && o->triangle_percent > 100) {
+                fprintf(stderr, "Error: --triangles takes a percentage (0-100)\n");
+                rc = -1;
+            }
+        }
+        else if (!strcmp(a, "--budget"))      rc = options_parse_double(v, a, &o->budget);
+        else if (!strcmp(a, "--tiles"))       rc = options_parse_range(v, a, &o->tile_begin, &o->tile_end);
+        else if (!strcmp(a, "--samples"))     rc = options_parse_range(v, a, &o->sample_begin, &o->sample_end);
+        else if (!strcmp(a, "--frames"))      rc = options_parse_range(v, a, &o->frame_begin, &o->frame_end);
+        else if (!strcmp(a, "--partial"))     o->partial = v;
+        else if (!strcmp(a, "--lookfrom")) {
+            rc = options_parse_list(v, a, o->lookfrom, 3);
+            o->lookfrom_set = 1;
+        }
+        else if (!strcmp(a, "--lookat")) {
+            rc = options_parse_list(v, a, o->lookat, 3);
+            o->lookat_set = 1;
+        }
+        else if (!strcmp(a, "--radiance-cache")) rc = options_parse_double(v, a, &o->cache_cell);
+        else if (!strcmp(a, "--cache-error")) rc = options_parse_double(v, a, &o->cache_error);
+        else if (!strcmp(a, "--cache-entries")) rc = options_parse_int(v, a, 1, &o->cache_entries);
+        else if (!strcmp(a, "--guide"))       rc = options_parse_double(v, a, &o->guide_cell);
+        else if (!strcmp(a, "--fov"))         rc = options_parse_double(v, a, &o->fov);
+        else if (!strcmp(a, "--daemon"))      o->daemon_socket = v;
+        else if (!strcmp(a, "--connect"))     o->connect_socket = v;
+        else if (!strcmp(a, "--crop"))        rc = options_parse_crop(v, a, o);
+        else if (!strcmp(a, "--priority"))    rc = options_parse_int(v, a, -INT_MAX, &o->priority);
+        else if (!strcmp(a, "--emit-c"))      o->emit_c = v;
+        else if (!strcmp(a, "--incremental")) o->incremental = v;
+        else if (!strcmp(a, "--publish"))     o->publish = v;
+        else if (!strcmp(a, "--mem-budget"))  rc = options_parse_double(v, a, &o->mem_budget);
+        else {
+            fprintf(stderr, "Error: unknown option '%s'\n", a);
+            options_usage(argv[0]);
+            return -1;
+        }
+
+        if (rc != 0)
+            return -1;
+        i++;
+    }
+    return 0;
+}
+
+#endif
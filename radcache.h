@@ -0,0 +1,176 @@
+#ifndef RADCACHE_H
+#define RADCACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+
+#include "vec3.h"
+
+/*
+ * World-space radiance cache for diffuse surfaces. Each entry covers one cell
+ * of a uniform grid and one bin of surface normals, and accumulates the
+ * incoming radiance of cosine-weighted paths leaving that cell. For a
+ * Lambertian surface the mean of those samples times the albedo is the
+ * outgoing radiance, so a converged entry can end a path at once; the albedo
+ * is applied per hit, so textures stay sharp.
+ *
+ * The table has a fixed number of entries (the size bound) with open
+ * addressing. Inserts claim empty slots with a compare-and-swap on the key
+ * and samples are added with atomic integer adds in fixed point, so render
+ * threads never take a lock. An entry answers queries only once it has
+ * RADCACHE_MIN_SAMPLES samples and the relative standard error of its mean
+ * luminance is within the cache's error bound.
+ */
+#define RADCACHE_MIN_SAMPLES 16
+#define RADCACHE_MAX_PROBES 16      /* slots tried before giving up on a full region */
+#define RADCACHE_NORMAL_BINS 4      /* per octahedral axis: 16 normal bins */
+#define RADCACHE_CELL_BITS 19       /* per axis: cells [-2^18, 2^18) around the origin */
+#define RADCACHE_FIXED_ONE 16777216.0   /* 2^24: fixed-point scale of the sums */
+#define RADCACHE_MAX_RADIANCE 64.0  /* samples are clamped so sums cannot overflow */
+#define RADCACHE_FIRST_BOUNCE 1     /* hits before this bounce (0: camera rays) never use the cache */
+
+typedef struct {
+    atomic_uint_least64_t key;      /* 0: empty */
+    atomic_uint_least64_t sum[3];   /* radiance sums, fixed point */
+    atomic_uint_least64_t sum_sq;   /* squared luminance sums, fixed point */
+    atomic_uint count;
+} radiance_entry;
+
+typedef struct {
+    radiance_entry *entries;
+    uint64_t mask;                  /* entry count - 1 */
+    double inv_cell;                /* 1 / cell size */
+    double max_error;               /* relative standard error bound */
+} radiance_cache;
+
+/* `entries` is rounded up to a power of two; returns 0, or -1 if out of memory */
+static inline int radcache_create(radiance_cache *c, double cell_size, double max_error, uint64_t entries) {
+    uint64_t n = 1;
+    while (n < entries)
+        n <<= 1;
+    c->entries = (radiance_entry *)calloc(n, sizeof(radiance_entry));
+    c->mask = n - 1;
+    c->inv_cell = 1.0 / cell_size;
+    c->max_error = max_error;
+    return c->entries ? 0 : -1;
+}
+
+static inline void radcache_free(radiance_cache *c) {
+    free(c->entries);
+    c->entries = NULL;
+}
+
+/* Empties the cache, e.g. between animation frames; not safe during a render */
+static inline void radcache_clear(radiance_cache *c) {
+    memset(c->entries, 0, sizeof(radiance_entry) * (size_t)(c->mask + 1));
+}
+
+static inline uint64_t radcache_cell(double x, double inv_cell) {
+    double half = (double)(1 << (RADCACHE_CELL_BITS - 1));
+    double i = floor(x * inv_cell) + half;
+    if (i < 0.0) i = 0.0;
+    if (i > 2.0 * half - 1.0) i = 2.0 * half - 1.0;
+    return (uint64_t)i;
+}
+
+/* Octahedral bin of a unit normal */
+static inline uint64_t radcache_normal_bin(vec3 n) {
+    double l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+    double u = n.x / l1, v = n.z / l1;
+    if (n.y < 0.0) {
+        double fu = (1.0 - fabs(v)) * (u >= 0.0 ? 1.0 : -1.0);
+        double fv = (1.0 - fabs(u)) * (v >= 0.0 ? 1.0 : -1.0);
+        u = fu;
+        v = fv;
+    }
+    int bu = (int)((u * 0.5 + 0.5) * RADCACHE_NORMAL_BINS);
+    int bv = (int)((v * 0.5 + 0.5) * RADCACHE_NORMAL_BINS);
+    if (bu > RADCACHE_NORMAL_BINS - 1) bu = RADCACHE_NORMAL_BINS - 1;
+    if (bv > RADCACHE_NORMAL_BINS - 1) bv = RADCACHE_NORMAL_BINS - 1;
+    return (uint64_t)(bu * RADCACHE_NORMAL_BINS + bv);
+}
+
+static inline uint64_t radcache_key(const radiance_cache *c, vec3 p, vec3 normal) {
+    uint64_t key = radcache_cell(p.x, c->inv_cell);
+    key = (key << RADCACHE_CELL_BITS) | radcache_cell(p.y, c->inv_cell);
+    key = (key << RADCACHE_CELL_BITS) | radcache_cell(p.z, c->inv_cell);
+    key = (key << 4) | radcache_normal_bin(normal);
+    return key | (1ull << 63);      /* never 0 */
+}
+
+static inline uint64_t radcache_hash(uint64_t key) {
+    key ^= key >> 30; key *= 0xBF58476D1CE4E5B9ull;
+    key ^= key >> 27; key *= 0x94D049BB133111EBull;
+    key ^= key >> 31;
+    return key;
+}
+
+/* Entry for the cell and normal bin of (p, normal), created if needed; NULL if the region is full */
+static inline radiance_entry *radcache_entry(radiance_cache *c, vec3 p, vec3 normal) {
+    uint64_t key = radcache_key(c, p, normal);
+    uint64_t slot = radcache_hash(key);
+    for (int probe = 0; probe < RADCACHE_MAX_PROBES; probe++, slot++) {
+        radiance_entry *e = &c->entries[slot & c->mask];
+        uint64_t found = atomic_load_explicit(&e->key, memory_order_relaxed);
+        if (found == key)
+            return e;
+        if (found == 0) {
+            uint_least64_t expected = 0;
+            if (atomic_compare_exchange_strong(&e->key, &expected, key) || expected == key)
+                return e;
+        }
+    }
+    return NULL;
+}
+
+/* Cached incoming radiance of `e`, if it has converged to within the error bound */
+static inline int radcache_lookup(const radiance_cache *c, const radiance_entry *e, vec3 *radiance) {
+    unsigned int n = atomic_load_explicit(&e->count, memory_order_relaxed);
+    if (n < RADCACHE_MIN_SAMPLES)
+        return 0;
+    double scale = 1.0 / (RADCACHE_FIXED_ONE * n);
+    vec3 mean = vec3_create(atomic_load_explicit(&e->sum[0], memory_order_relaxed) * scale,
+                            atomic_load_explicit(&e->sum[1], memory_order_relaxed) * scale,
+                            atomic_load_explicit(&e->sum[2], memory_order_relaxed) * scale);
+    double lum = 0.2126 * mean.x + 0.7152 * mean.y + 0.0722 * mean.z;
+    double lum_sq = atomic_load_explicit(&e->sum_sq, memory_order_relaxed) * scale;
+    double variance = lum_sq - lum * lum;
+    if (variance < 0.0)
+        variance = 0.0;
+    if (lum <= 0.0 || variance > c->max_error * c->max_error * lum * lum * n)
+        return 0;
+    *radiance = mean;
+    return 1;
+}
+
+/* Adds one incoming radiance sample to `e` */
+static inline void radcache_add(radiance_entry *e, vec3 radiance) {
+    double r = fmin(fmax(radiance.x, 0.0), RADCACHE_MAX_RADIANCE);
+    double g = fmin(fmax(radiance.y, 0.0), RADCACHE_MAX_RADIANCE);
+    double b = fmin(fmax(radiance.z, 0.0), RADCACHE_MAX_RADIANCE);
+    double lum = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+    atomic_fetch_add_explicit(&e->sum[0], (uint64_t)(r * RADCACHE_FIXED_ONE), memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->sum[1], (uint64_t)(g * RADCACHE_FIXED_ONE), memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->sum[2], (uint64_t)(b * RADCACHE_FIXED_ONE), memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->sum_sq, (uint64_t)(lum * lum * RADCACHE_FIXED_ONE), memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->count, 1, memory_order_relaxed);
+}
+
+/* Entries in use, and how many of those currently answer queries */
+static inline void radcache_stats(const radiance_cache *c, uint64_t *used, uint64_t *converged) {
+    *used = *converged = 0;
+    for (uint64_t i = 0; i <= c->mask; i++) {
+        const radiance_entry *e = &c->entries[i];
+        vec3 unused;
+        if (atomic_load(&e->key) == 0)
+            continue;
+        (*used)++;
+        if (radcache_lookup(c, e, &unused))
+            (*converged)++;
+    }
+}
+
+#endif
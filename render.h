@@ -0,0 +1,417 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vec3.h"
+#include "ray.h"
+#include "camera.h"
+#include "material.h"
+#include "scene.h"
+#include "accum.h"
+#include "radcache.h"
+#include "guiding.h"
+#include "incremental.h"
+#include "shmfb.h"
+#include "visibility.h"
+
+/* Work is handed to threads in square tiles, numbered row-major from the top left */
+#define TILE_SIZE 32
+
+/* Largest progressive pass; keeps one tile's work short so deadlines are met closely */
+#define RENDER_MAX_PASS_SAMPLES 16
+
+/*
+ * A render job: which tiles and which samples of each pixel go into `accum`.
+ * The job's width x height image is the window at (crop_x, crop_y) of the
+ * full_width x full_height image the camera covers; normally the whole of it.
+ */
+typedef struct {
+    scene *world;
+    camera cam;
+    int width, height;
+    int full_width, full_height;
+    int crop_x, crop_y;
+    int max_depth;
+    accum_buffer *accum;
+    int tile_begin, tile_end;
+    int sample_begin, sample_end;
+    unsigned int seed;
+    int frame;
+    double deadline;        /* render_clock() time to stop taking tiles, 0: none */
+    radiance_cache *cache;  /* diffuse radiance cache, NULL: trace every path */
+    path_guide *guide;      /* learned diffuse sampling, NULL: cosine sampling only */
+    incr_tile *records;     /* per image tile: primitives seen (incremental.h), NULL: not recorded */
+    const int *tile_list;   /* if set, tiles [tile_begin, tile_end) index this list of image tiles */
+    shmfb *publish;         /* shared framebuffer finished tiles are copied to (uncropped jobs), NULL: none */
+    visibility *vis;        /* camera-ray candidate lists (uncropped jobs, visibility.h), NULL: trace all */
+    atomic_int next_tile;
+    atomic_int expired;     /* set once a tile was left unrendered at the deadline */
+} render_job;
+
+/* Monotonic wall clock in seconds */
+static inline double render_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Size of the next progressive pass after `done` samples per pixel: 1, 1, 2,
+ * 4, ... so early images come quickly, capped at RENDER_MAX_PASS_SAMPLES.
+ */
+static inline int render_pass_samples(int done) {
+    if (done == 0)
+        return 1;
+    return done < RENDER_MAX_PASS_SAMPLES ? done : RENDER_MAX_PASS_SAMPLES;
+}
+
+static inline int render_tiles_x(int width) {
+    return (width + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+static inline int render_tiles_y(int height) {
+    return (height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+static inline int render_tile_count(int width, int height) {
+    return render_tiles_x(width) * render_tiles_y(height);
+}
+
+/* Pixels in image tile `tile` (edge tiles are cut off by the image border) */
+static inline int render_tile_pixels(int width, int height, int tile) {
+    int tx = render_tiles_x(width);
+    int x0 = (tile % tx) * TILE_SIZE, y0 = (tile / tx) * TILE_SIZE;
+    int w = x0 + TILE_SIZE < width ? TILE_SIZE : width - x0;
+    int h = y0 + TILE_SIZE < height ? TILE_SIZE : height - y0;
+    return w * h;
+}
+
+/* Image rows [*y0, *y1) covered by tiles [tile_begin, tile_end) */
+static inline void render_tile_rows(int width, int height, int tile_begin, int tile_end, int *y0, int *y1) {
+    int tx = render_tiles_x(width);
+    *y0 = (tile_begin / tx) * TILE_SIZE;
+    *y1 = ((tile_end - 1) / tx + 1) * TILE_SIZE;
+    if (*y1 > height) *y1 = height;
+}
+
+/* Sets up a job covering every tile of a width x height image, samples [0, 1) */
+static inline void render_job_init(render_job *job, scene *world, camera cam, int width, int height,
+                                   int max_depth, accum_buffer *accum, unsigned int seed, int frame) {
+    job->world = world;
+    job->cam = cam;
+    job->width = width;
+    job->height = height;
+    job->full_width = width;
+    job->full_height = height;
+    job->crop_x = 0;
+    job->crop_y = 0;
+    job->max_depth = max_depth;
+    job->accum = accum;
+    job->tile_begin = 0;
+    job->tile_end = render_tile_count(width, height);
+    job->sample_begin = 0;
+    job->sample_end = 1;
+    job->seed = seed;
+    job->frame = frame;
+    job->deadline = 0.0;
+    job->cache = NULL;
+    job->guide = NULL;
+    job->records = NULL;
+    job->tile_list = NULL;
+    job->publish = NULL;
+    job->vis = NULL;
+    atomic_init(&job->next_tile, 0);
+    atomic_init(&job->expired, 0);
+}
+
+/*
+ * Seed for one tile of one sample range. Mixing in the frame, tile and first
+ * sample keeps every shard's random stream independent and reproducible.
+ */
+static inline unsigned int render_seed(unsigned int base, int frame, int tile, int sample) {
+    uint32_t h = base;
+    h ^= (uint32_t)frame * 0x9E3779B1u;
+    h ^= (uint32_t)tile * 0x85EBCA77u;
+    h ^= (uint32_t)sample * 0xC2B2AE3Du;
+    h ^= h >> 16; h *= 0x7FEB352Du;
+    h ^= h >> 15; h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Sky gradient colors straight down and straight up, blended by the ray's height */
+#define RENDER_SKY_BOTTOM 1.0, 1.0, 1.0
+#define RENDER_SKY_TOP 0.5, 0.7, 1.0
+
+/* A binary built against a compiled scene (emit.h) traces its baked geometry instead */
+#ifdef SCENE_COMPILED
+#define RENDER_SCENE_HIT(world, r, t_min, t_max, rec) ((void)(world), compiled_scene_hit(r, t_min, t_max, rec))
+#else
+#define RENDER_SCENE_HIT(world, r, t_min, t_max, rec) scene_hit(world, r, t_min, t_max, rec)
+#endif
+
+/* Camera rays of a pixel with a visibility list test its candidates first */
+static inline int render_hit(const render_job *job, int depth, ray r, hit_record *rec) {
+    if (depth == job->max_depth && tl_primary.prims) {
+        int hit = visibility_hit(job->world, tl_primary, r, 0.001, 1e30, rec);
+        if (hit >= 0)
+            return hit;
+        tl_primary_traced++;
+    }
+    return RENDER_SCENE_HIT(job->world, r, 0.001, 1e30, rec);
+}
+
+static vec3 ray_color(ray r, const render_job *job, int depth) {
+    if (depth <= 0)
+        return vec3_create(0, 0, 0);
+
+    hit_record rec = {0};
+    if (render_hit(job, depth, r, &rec)) {
+        if (job->records && job->max_depth - depth <= INCR_RECORD_BOUNCES)
+            incr_set_add(&tl_touched, rec.prim);
+
+        /* Diffuse hits after the first bounces read converged radiance from the cache, or feed it */
+        radiance_entry *entry = NULL;
+        if (job->cache && rec.mat.type == MAT_LAMBERTIAN && job->max_depth - depth >= RADCACHE_FIRST_BOUNCE) {
+            vec3 cached;
+            entry = radcache_entry(job->cache, rec.p, rec.normal);
+            if (entry && radcache_lookup(job->cache, entry, &cached))
+                return vec3_mul(texture_value(rec.mat.tex, rec.p), cached);
+        }
+
+        ray scattered;
+        vec3 attenuation;
+        guide_cell *cell = NULL;
+        double pdf = 0.0;
+        double weight = 1.0;    /* cosine term over sampling pdf, relative to cosine sampling */
+        if (job->guide && rec.mat.type == MAT_LAMBERTIAN) {
+            cell = guide_cell_at(job->guide, rec.p);
+            vec3 dir = guide_scatter(cell, rec.normal, &pdf);
+            double cos_theta = vec3_dot(dir, rec.normal);
+            weight = cos_theta > 0.0 ? cos_theta / (M_PI * pdf) : 0.0;
+            scattered = ray_create(rec.p, dir);
+            attenuation = vec3_scale(texture_value(rec.mat.tex, rec.p), weight);
+        } else if (!material_scatter(rec.mat, r, &rec, &attenuation, &scattered)) {
+            return vec3_create(0, 0, 0);
+        }
+
+        vec3 incoming = vec3_create(0, 0, 0);
+        if (weight > 0.0) {
+            incoming = ray_color(scattered, job, depth - 1);
+            if (cell)
+                guide_record(cell, scattered.direction, incoming, pdf);
+        }
+        if (entry)
+            radcache_add(entry, vec3_scale(incoming, weight));
+        return vec3_mul(attenuation, incoming);
+    }
+
+    /* Sky gradient */
+    vec3 unit_dir = vec3_unit(r.direction);
+    double t = 0.5 * (unit_dir.y + 1.0);
+    return vec3_add(
+        vec3_scale(vec3_create(RENDER_SKY_BOTTOM), 1.0 - t),
+        vec3_scale(vec3_create(RENDER_SKY_TOP), t));
+}
+
+static void render_tile(render_job *job, int tile) {
+    if (job->tile_list)
+        tile = job->tile_list[tile];
+    int tx = render_tiles_x(job->width);
+    int x0 = (tile % tx) * TILE_SIZE;
+    int y0 = (tile / tx) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < job->width ? x0 + TILE_SIZE : job->width;
+    int y1 = y0 + TILE_SIZE < job->height ? y0 + TILE_SIZE : job->height;
+    int n = job->sample_end - job->sample_begin;
+    uint64_t start_ns = job->publish ? shmfb_now_ns() : 0;
+
+    /* Seeded by the tile's place in the full image, so a tile-aligned crop repeats the full render */
+    int full_tile = ((job->crop_y + y0) / TILE_SIZE) * render_tiles_x(job->full_width)
+                  + (job->crop_x + x0) / TILE_SIZE;
+    tl_seed = render_seed(job->seed, job->frame, full_tile, job->sample_begin);
+    if (job->records)
+        incr_set_begin(&tl_touched, &job->records[tile]);
+    if (job->vis) {
+        visibility_build_tile(job->vis, tile, x0, y0, x1, y1);
+        tl_primary_traced = 0;
+    }
+
+    for (int y = y0; y < y1; y++) {
+        int j = job->full_height - 1 - (job->crop_y + y);
+        for (int i = x0; i < x1; i++) {
+            vec3 pixel_color = vec3_create(0, 0, 0);
+            if (job->vis)
+                tl_primary = visibility_list(job->vis, tile, x0, y0, i, y);
+            for (int s = 0; s < n; s++) {
+                double u = (job->crop_x + i + random_double()) / (job->full_width - 1);
+                double v = (j + random_double()) / (job->full_height - 1);
+                ray r = camera_get_ray(&job->cam, u, v);
+                pixel_color = vec3_add(pixel_color, ray_color(r, job, job->max_depth));
+            }
+            accum_add(job->accum, i, y, pixel_color, n);
+        }
+    }
+    if (job->vis) {
+        tl_primary = (vis_list){NULL, 0, 0.0};
+        atomic_fetch_add(&job->vis->rays, (uint64_t)(x1 - x0) * (y1 - y0) * n);
+        atomic_fetch_add(&job->vis->traced, tl_primary_traced);
+    }
+    if (job->records)
+        incr_set_end(&tl_touched, &job->records[tile]);
+    if (job->publish)
+        shmfb_publish_tile(job->publish, job->accum, x0, y0, x1, y1, (uint64_t)(x1 - x0) * (y1 - y0) * n,
+                           shmfb_now_ns() - start_ns);
+}
+
+static void *render_worker(void *arg) {
+    render_job *job = (render_job *)arg;
+    for (;;) {
+        int tile = atomic_fetch_add(&job->next_tile, 1);
+        if (tile >= job->tile_end)
+            break;
+        /* Only a claimed tile left unrendered makes the pass incomplete */
+        if (job->deadline > 0.0 && render_clock() >= job->deadline) {
+            atomic_store(&job->expired, 1);
+            break;
+        }
+        render_tile(job, tile);
+    }
+    return NULL;
+}
+
+/*
+ * Renders the job's tiles and sample range on `num_threads` threads. Returns 1
+ * if every tile was rendered, 0 if the deadline cut the pass short.
+ */
+static inline int render_run(render_job *job, int num_threads) {
+    pthread_t threads[num_threads];
+    atomic_store(&job->next_tile, job->tile_begin);
+    atomic_store(&job->expired, 0);
+
+    for (int t = 0; t < num_threads; t++)
+        pthread_create(&threads[t], NULL, render_worker, job);
+    for (int t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+    return !atomic_load(&job->expired);
+}
+
+/*
+ * Persistent worker pool shared by many jobs. Workers take tiles from the
+ * highest-priority queued job (first come first served within a priority), so
+ * an urgent job overtakes running ones at the next tile boundary. Job
+ * deadlines are not used here.
+ */
+typedef struct render_task {
+    render_job *job;
+    int priority;
+    int tiles_left;         /* tiles not yet finished */
+    int done;
+    struct render_task *next;
+} render_task;
+
+typedef struct {
+    pthread_t *threads;
+    int num_threads;
+    render_task *queue;     /* highest priority first */
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* tasks queued, or stopping */
+    pthread_cond_t done;    /* a task finished */
+} render_pool;
+
+static void *render_pool_worker(void *arg) {
+    render_pool *pool = (render_pool *)arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        render_task *task = pool->queue;
+        while (task && atomic_load(&task->job->next_tile) >= task->job->tile_end)
+            task = task->next;
+        if (!task) {
+            if (pool->stopping)
+                break;
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+
+        int tile = atomic_fetch_add(&task->job->next_tile, 1);
+        pthread_mutex_unlock(&pool->lock);
+        render_tile(task->job, tile);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--task->tiles_left == 0) {
+            render_task **link = &pool->queue;
+            while (*link != task)
+                link = &(*link)->next;
+            *link = task->next;
+            task->done = 1;
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Starts `num_threads` workers; returns 0, or -1 if no thread could be started */
+static inline int render_pool_init(render_pool *pool, int num_threads) {
+    pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)num_threads);
+    pool->num_threads = 0;
+    pool->queue = NULL;
+    pool->stopping = 0;
+    if (!pool->threads)
+        return -1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int t = 0; t < num_threads; t++) {
+        if (pthread_create(&pool->threads[t], NULL, render_pool_worker, pool) != 0)
+            break;
+        pool->num_threads++;
+    }
+    return pool->num_threads > 0 ? 0 : -1;
+}
+
+/* Queues `job` (all of its tiles, its sample range); `task` must outlive the job */
+static inline void render_pool_submit(render_pool *pool, render_task *task, render_job *job, int priority) {
+    task->job = job;
+    task->priority = priority;
+    task->tiles_left = job->tile_end - job->tile_begin;
+    task->done = 0;
+    atomic_store(&job->next_tile, job->tile_begin);
+
+    pthread_mutex_lock(&pool->lock);
+    render_task **link = &pool->queue;
+    while (*link && (*link)->priority >= priority)
+        link = &(*link)->next;
+    task->next = *link;
+    *link = task;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static inline void render_pool_wait(render_pool *pool, render_task *task) {
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Lets queued jobs finish, then stops the workers */
+static inline void render_pool_destroy(render_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->num_threads; t++)
+        pthread_join(pool->threads[t], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+}
+
+#endif
@@ -1,71 +1,253 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <stdint.h>
+
 #include "sphere.h"
 #include "plane.h"
 #include "triangle.h"
 #include "aabb.h"
+#include "arena.h"
+#include "bvh.h"
+#include "instance.h"
+
+/*
+ * Primitives live in arena-backed arrays with no capacity limit. Adding a
+ * primitive returns a handle (its index in that primitive's array) that stays
+ * valid, as does the primitive's address, for as long as the scene exists.
+ */
+typedef uint32_t scene_handle;
+#define SCENE_INVALID_HANDLE UINT32_MAX
+
+/*
+ * Scene-wide primitive ids, as reported in hit_record.prim: the primitive's
+ * kind in the top two bits and its handle below. Ids stay the same when a
+ * scene is rebuilt the same way, so they can be compared across renders.
+ */
+#define SCENE_PRIM_SPHERE   0u
+#define SCENE_PRIM_TRIANGLE 1u
+#define SCENE_PRIM_INSTANCE 2u
+#define SCENE_PRIM_PLANE    3u
+#define SCENE_PRIM_KINDS    4
+#define SCENE_PRIM_KIND_SHIFT 30
+#define SCENE_PRIM_INDEX_MASK ((1u << SCENE_PRIM_KIND_SHIFT) - 1)
 
-#define MAX_SPHERES 500
-#define MAX_PLANES  10
-#define MAX_TRIANGLES 1000
+static inline uint32_t scene_prim_id(uint32_t kind, scene_handle h) {
+    return (kind << SCENE_PRIM_KIND_SHIFT) | h;
+}
 
 typedef struct {
-    sphere spheres[MAX_SPHERES];
-    int num_spheres;
-    plane planes[MAX_PLANES];
-    int num_planes;
-    triangle triangles[MAX_TRIANGLES];
-    int num_triangles;
+    arena mem;
+    arena_array spheres;
+    arena_array planes;
+    arena_array triangles;
+    arena_array instances;
+
+    /* Built by scene_commit over spheres, then triangles, then instances; planes are unbounded */
+    bvh accel;
+    uint32_t accel_spheres, accel_triangles;
+    int committed;
 } scene;
 
+static inline sphere *scene_sphere(const scene *s, scene_handle h) {
+    return (sphere *)arena_array_at(&s->spheres, h);
+}
+
+static inline plane *scene_plane(const scene *s, scene_handle h) {
+    return (plane *)arena_array_at(&s->planes, h);
+}
+
+static inline triangle *scene_triangle(const scene *s, scene_handle h) {
+    return (triangle *)arena_array_at(&s->triangles, h);
+}
+
+static inline instance *scene_instance(const scene *s, scene_handle h) {
+    return (instance *)arena_array_at(&s->instances, h);
+}
+
+/* Releases a scene's storage; a zero-initialised scene is valid input */
+static inline void scene_free(scene *s) {
+    arena_array_free(&s->spheres);
+    arena_array_free(&s->planes);
+    arena_array_free(&s->triangles);
+    arena_array_free(&s->instances);
+    arena_free(&s->mem);
+    bvh_free(&s->accel);
+    s->committed = 0;
+}
+
+/* Resets a zero-initialised or previously used scene to empty */
 static inline void scene_init(scene *s) {
-    s->num_spheres = 0;
-    s->num_planes = 0;
-    s->num_triangles = 0;
+    scene_free(s);
+    arena_array_init(&s->spheres, sizeof(sphere));
+    arena_array_init(&s->planes, sizeof(plane));
+    arena_array_init(&s->triangles, sizeof(triangle));
+    arena_array_init(&s->instances, sizeof(instance));
+    s->accel_spheres = s->accel_triangles = 0;
 }
 
-static inline void scene_add_sphere(scene *s, sphere sp) {
-    if (s->num_spheres < MAX_SPHERES)
-        s->spheres[s->num_spheres++] = sp;
+/* Handles must stay below the kind bits of scene_prim_id */
+static inline scene_handle scene_push(scene *s, arena_array *arr, const void *elem) {
+    s->committed = 0;
+    if (arr->count > SCENE_PRIM_INDEX_MASK)
+        return SCENE_INVALID_HANDLE;
+    return arena_array_push(arr, &s->mem, elem);
 }
 
-static inline void scene_add_plane(scene *s, plane pl) {
-    if (s->num_planes < MAX_PLANES)
-        s->planes[s->num_planes++] = pl;
+/*
+ * The add functions return the new primitive's handle, or SCENE_INVALID_HANDLE
+ * if out of memory or the scene already has 2^30 primitives of that kind.
+ */
+static inline scene_handle scene_add_sphere(scene *s, sphere sp) {
+    return scene_push(s, &s->spheres, &sp);
 }
 
-static inline void scene_add_triangle(scene *s, triangle tri) {
-    if (s->num_triangles < MAX_TRIANGLES)
-        s->triangles[s->num_triangles++] = tri;
+static inline scene_handle scene_add_plane(scene *s, plane pl) {
+    return scene_push(s, &s->planes, &pl);
 }
 
-static inline int scene_hit(scene *s, ray r, double t_min, double t_max, hit_record *rec) {
+static inline scene_handle scene_add_triangle(scene *s, triangle tri) {
+    return scene_push(s, &s->triangles, &tri);
+}
+
+static inline scene_handle scene_add_instance(scene *s, instance inst) {
+    return scene_push(s, &s->instances, &inst);
+}
+
+static inline uint32_t scene_num_primitives(const scene *s) {
+    return s->spheres.count + s->planes.count + s->triangles.count + s->instances.count;
+}
+
+/* Bytes held by primitive storage and acceleration structures */
+static inline size_t scene_memory(const scene *s) {
+    return s->mem.reserved
+         + (size_t)s->accel.num_nodes * sizeof(bvh_node)
+         + (size_t)s->accel.num_prims * sizeof(int);
+}
+
+/* Bounds of BVH primitive `prim`: spheres, then triangles, then instances */
+static inline aabb scene_prim_bounds(const scene *s, int prim) {
+    uint32_t p = (uint32_t)prim;
+    if (p < s->accel_spheres)
+        return sphere_bounds(*scene_sphere(s, p));
+    if ((p -= s->accel_spheres) < s->accel_triangles)
+        return triangle_bounds(*scene_triangle(s, p));
+    return scene_instance(s, p - s->accel_triangles)->world_bounds;
+}
+
+/*
+ * Builds acceleration structures; call once the scene is complete. Until
+ * then, or after further adds, scene_hit falls back to testing every
+ * primitive. Returns -1 if out of memory.
+ */
+static inline int scene_commit(scene *s) {
+    bvh_free(&s->accel);
+    s->committed = 0;
+    s->accel_spheres = s->spheres.count;
+    s->accel_triangles = s->triangles.count;
+
+    size_t n = (size_t)s->spheres.count + s->triangles.count + s->instances.count;
+    if (n > INT32_MAX)
+        return -1;
+    aabb *boxes = (aabb *)malloc(sizeof(aabb) * (n ? n : 1));
+    if (!boxes) return -1;
+
+    for (size_t k = 0; k < n; k++)
+        boxes[k] = scene_prim_bounds(s, (int)k);
+
+    int rc = bvh_build(&s->accel, boxes, (int)n);
+    free(boxes);
+    if (rc == 0)
+        s->committed = 1;
+    return rc;
+}
+
+/* Intersects BVH primitive `prim`: spheres, then triangles, then instances */
+static inline int scene_prim_hit(const void *ctx, int prim, ray r, double t_min, double t_max, hit_record *rec) {
+    const scene *s = (const scene *)ctx;
+    uint32_t p = (uint32_t)prim;
+    uint32_t kind = SCENE_PRIM_SPHERE;
+    int hit;
+    if (p < s->accel_spheres) {
+        hit = sphere_hit(*scene_sphere(s, p), r, t_min, t_max, rec);
+    } else if ((p -= s->accel_spheres) < s->accel_triangles) {
+        hit = triangle_hit(*scene_triangle(s, p), r, t_min, t_max, rec);
+        kind = SCENE_PRIM_TRIANGLE;
+    } else {
+        p -= s->accel_triangles;
+        hit = instance_hit(scene_instance(s, p), r, t_min, t_max, rec);
+        kind = SCENE_PRIM_INSTANCE;
+    }
+    if (hit)
+        rec->prim = scene_prim_id(kind, p);
+    return hit;
+}
+
+/* Closest plane hit before *closest, which it lowers; planes are never in the BVH */
+static inline int scene_planes_hit(const scene *s, ray r, double t_min, double *closest, hit_record *rec) {
     hit_record temp_rec;
     int hit_anything = 0;
+    for (uint32_t c = 0; c < s->planes.num_chunks; c++) {
+        const plane *planes = (const plane *)s->planes.chunks[c];
+        uint32_t n = arena_array_chunk_len(&s->planes, c);
+        for (uint32_t i = 0; i < n; i++) {
+            if (plane_hit(planes[i], r, t_min, *closest, &temp_rec)) {
+                hit_anything = 1;
+                *closest = temp_rec.t;
+                *rec = temp_rec;
+                rec->prim = scene_prim_id(SCENE_PRIM_PLANE, (c << ARENA_CHUNK_SHIFT) + i);
+            }
+        }
+    }
+    return hit_anything;
+}
+
+static inline int scene_hit(scene *s, ray r, double t_min, double t_max, hit_record *rec) {
+    hit_record temp_rec;
     double closest_so_far = t_max;
+    int hit_anything = scene_planes_hit(s, r, t_min, &closest_so_far, rec);
 
-    for (int i = 0; i < s->num_spheres; i++) {
-        if (sphere_hit(s->spheres[i], r, t_min, closest_so_far, &temp_rec)) {
+    if (s->committed) {
+        if (bvh_hit(&s->accel, r, t_min, closest_so_far, &temp_rec, scene_prim_hit, s)) {
             hit_anything = 1;
-            closest_so_far = temp_rec.t;
             *rec = temp_rec;
         }
+        return hit_anything;
     }
 
-    for (int i = 0; i < s->num_planes; i++) {
-        if (plane_hit(s->planes[i], r, t_min, closest_so_far, &temp_rec)) {
-            hit_anything = 1;
-            closest_so_far = temp_rec.t;
-            *rec = temp_rec;
+    /* Not committed: test everything */
+    for (uint32_t c = 0; c < s->spheres.num_chunks; c++) {
+        const sphere *spheres = (const sphere *)s->spheres.chunks[c];
+        uint32_t n = arena_array_chunk_len(&s->spheres, c);
+        for (uint32_t i = 0; i < n; i++) {
+            if (sphere_hit(spheres[i], r, t_min, closest_so_far, &temp_rec)) {
+                hit_anything = 1;
+                closest_so_far = temp_rec.t;
+                *rec = temp_rec;
+                rec->prim = scene_prim_id(SCENE_PRIM_SPHERE, (c << ARENA_CHUNK_SHIFT) + i);
+            }
+        }
+    }
+
+    for (uint32_t c = 0; c < s->triangles.num_chunks; c++) {
+        const triangle *triangles = (const triangle *)s->triangles.chunks[c];
+        uint32_t n = arena_array_chunk_len(&s->triangles, c);
+        for (uint32_t i = 0; i < n; i++) {
+            if (triangle_hit(triangles[i], r, t_min, closest_so_far, &temp_rec)) {
+                hit_anything = 1;
+                closest_so_far = temp_rec.t;
+                *rec = temp_rec;
+                rec->prim = scene_prim_id(SCENE_PRIM_TRIANGLE, (c << ARENA_CHUNK_SHIFT) + i);
+            }
         }
     }
 
-    for (int i = 0; i < s->num_triangles; i++) {
-        if (triangle_hit(s->triangles[i], r, t_min, closest_so_far, &temp_rec)) {
+    for (uint32_t i = 0; i < s->instances.count; i++) {
+        if (instance_hit(scene_instance(s, i), r, t_min, closest_so_far, &temp_rec)) {
             hit_anything = 1;
             closest_so_far = temp_rec.t;
             *rec = temp_rec;
+            rec->prim = scene_prim_id(SCENE_PRIM_INSTANCE, i);
         }
     }
 
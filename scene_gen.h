@@ -0,0 +1,131 @@
+#ifndef SCENE_GEN_H
+#define SCENE_GEN_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "vec3.h"
+#include "material.h"
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "scene.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Procedural stress scenes for measuring how rendering scales with scene
+ * size. Primitive sizes shrink with the count so the occupied volume (or
+ * area, for the ground layer) stays the same at 1k and at 10M primitives,
+ * which keeps images comparable and isolates the cost of scene size.
+ */
+typedef enum {
+    SCENE_GEN_UNIFORM,      /* uniformly filling a cube */
+    SCENE_GEN_CLUSTERED,    /* Gaussian clusters inside the cube */
+    SCENE_GEN_LAYER         /* a single layer resting on the ground, like the demo */
+} scene_gen_distribution;
+
+typedef struct {
+    uint32_t count;                 /* primitives to generate, besides the ground plane */
+    scene_gen_distribution distribution;
+    double triangle_fraction;       /* share of triangles; the rest are spheres */
+    double extent;                  /* half-size of the cube (or square) filled */
+    double fill;                    /* fraction of the volume or area the primitives occupy */
+    int clusters;                   /* for SCENE_GEN_CLUSTERED */
+} scene_gen_params;
+
+static inline scene_gen_params scene_gen_defaults(uint32_t count) {
+    return (scene_gen_params){count, SCENE_GEN_UNIFORM, 0.25, 10.0, 0.05, 64};
+}
+
+/* Parses "uniform", "clustered" or "layer"; returns -1 for anything else */
+static inline int scene_gen_parse_distribution(const char *name, scene_gen_distribution *out) {
+    if (!strcmp(name, "uniform"))   { *out = SCENE_GEN_UNIFORM;   return 0; }
+    if (!strcmp(name, "clustered")) { *out = SCENE_GEN_CLUSTERED; return 0; }
+    if (!strcmp(name, "layer"))     { *out = SCENE_GEN_LAYER;     return 0; }
+    return -1;
+}
+
+/* Standard normal sample (Box-Muller) */
+static inline double scene_gen_gaussian(void) {
+    double u1 = random_double_range(1e-12, 1.0);
+    double u2 = random_double();
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static inline material scene_gen_material(void) {
+    double choose_mat = random_double();
+    if (choose_mat < 0.8)
+        return mat_lambertian(vec3_mul(vec3_random(), vec3_random()));
+    if (choose_mat < 0.95)
+        return mat_metal(vec3_random_range(0.5, 1.0), random_double_range(0.0, 0.5));
+    return mat_dielectric(1.5);
+}
+
+/*
+ * Fills `s` (already initialised) with p->count primitives drawn from the
+ * current thread's random stream, plus a ground plane at y = 0. Returns 0, or
+ * -1 if the scene ran out of memory or of primitive handles.
+ */
+static inline int scene_generate(scene *s, const scene_gen_params *p) {
+    double e = p->extent;
+    double n = p->count > 0 ? (double)p->count : 1.0;
+
+    /* Radius giving the requested fill: n * (4/3) pi r^3 = fill * (2e)^3, or n * pi r^2 = fill * (2e)^2 */
+    double radius = p->distribution == SCENE_GEN_LAYER
+        ? 2.0 * e * sqrt(p->fill / (M_PI * n))
+        : 2.0 * e * cbrt(p->fill * 3.0 / (4.0 * M_PI * n));
+
+    vec3 cluster_centers[256];
+    int clusters = p->clusters < 1 ? 1 : (p->clusters > 256 ? 256 : p->clusters);
+    double sigma = e / (2.0 * cbrt((double)clusters));
+    for (int c = 0; c < clusters; c++)
+        cluster_centers[c] = vec3_create(random_double_range(-e, e), random_double_range(0.0, 2.0 * e),
+                                         random_double_range(-e, e));
+
+    if (scene_add_plane(s, (plane){
+            vec3_create(0, 0, 0),
+            vec3_create(0, 1, 0),
+            mat_lambertian_tex(texture_checker(vec3_create(0.2, 0.3, 0.1), vec3_create(0.9, 0.9, 0.9), 2.0))
+        }) == SCENE_INVALID_HANDLE)
+        return -1;
+
+    for (uint32_t i = 0; i < p->count; i++) {
+        vec3 center;
+        switch (p->distribution) {
+            case SCENE_GEN_CLUSTERED: {
+                vec3 c = cluster_centers[(int)(random_double() * clusters)];
+                center = vec3_add(c, vec3_scale(vec3_create(scene_gen_gaussian(), scene_gen_gaussian(),
+                                                            scene_gen_gaussian()), sigma));
+                if (center.y < radius) center.y = radius;
+                break;
+            }
+            case SCENE_GEN_LAYER:
+                center = vec3_create(random_double_range(-e, e), radius, random_double_range(-e, e));
+                break;
+            default:
+                center = vec3_create(random_double_range(-e, e), random_double_range(radius, 2.0 * e),
+                                     random_double_range(-e, e));
+                break;
+        }
+
+        material mat = scene_gen_material();
+        scene_handle h;
+        if (random_double() < p->triangle_fraction) {
+            /* Randomly oriented triangle inscribed in the primitive's sphere */
+            vec3 a = vec3_add(center, vec3_scale(random_unit_vector(), radius));
+            vec3 b = vec3_add(center, vec3_scale(random_unit_vector(), radius));
+            vec3 c = vec3_add(center, vec3_scale(random_unit_vector(), radius));
+            h = scene_add_triangle(s, (triangle){a, b, c, mat});
+        } else {
+            h = scene_add_sphere(s, (sphere){center, radius, mat});
+        }
+        if (h == SCENE_INVALID_HANDLE)
+            return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef SHMFB_H
+#define SHMFB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "accum.h"
+
+/*
+ * Shared-memory framebuffer: a render publishes its accumulation into a POSIX
+ * shared memory object (--publish NAME) that viewers and monitoring tools map
+ * read-only and poll whenever they like, without talking to the renderer.
+ *
+ * The object holds a header with the image layout and running throughput
+ * counters, one record per tile, and the radiance sums of every pixel (3
+ * floats, rows top-down). A worker copies a tile in right after rendering it;
+ * each tile is guarded by a sequence lock, so the writer never waits and a
+ * reader retries the rare copy that overlapped a write. Every pixel of a tile
+ * holds the same number of samples, kept in the tile record. Host byte order:
+ * readers run on the same machine.
+ */
+#define SHMFB_MAGIC "VTSHMFB"
+#define SHMFB_VERSION 1
+#define SHMFB_READ_RETRIES 1000     /* a tile still busy after this many tries is skipped */
+
+enum { SHMFB_RENDERING = 0, SHMFB_DONE = 1 };
+
+typedef struct {
+    char magic[8];                  /* written last: the object is ready once it is set */
+    uint32_t version;
+    int32_t width, height;
+    int32_t tile_size, tiles_x, tiles_y;
+    int32_t threads;
+    int32_t pid;                    /* the rendering process */
+    uint64_t tiles_offset, pixels_offset, size;     /* byte offsets and size of the object */
+
+    /* This frame so far; times are CLOCK_MONOTONIC nanoseconds */
+    atomic_int frame;
+    atomic_int state;               /* SHMFB_RENDERING or SHMFB_DONE */
+    atomic_uint_least64_t start_ns;
+    atomic_uint_least64_t update_ns;    /* last tile published */
+    atomic_uint_least64_t target;       /* pixel samples the frame will take */
+    atomic_uint_least64_t samples;      /* pixel samples rendered */
+    atomic_uint_least64_t tile_passes;  /* tiles published */
+    atomic_uint_least64_t busy_ns;      /* render thread time behind them */
+} shmfb_header;
+
+/* A tile's record; one per cache line so workers on neighbouring tiles do not share lines */
+typedef struct {
+    _Alignas(64) atomic_uint seq;   /* odd while the tile is being written */
+    int32_t frame;
+    uint32_t samples;               /* per pixel */
+    uint32_t passes;                /* times published this frame */
+    uint64_t busy_ns;               /* render time spent on the tile this frame */
+} shmfb_tile;
+
+typedef struct {
+    shmfb_header *header;
+    shmfb_tile *tiles;
+    float *rgb;                     /* radiance sums, 3 floats per pixel */
+    size_t size;
+    char name[64];
+    int owner;                      /* created by this process, which unlinks it */
+} shmfb;
+
+static inline uint64_t shmfb_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Shared memory object names start with a slash; NAME and /NAME mean the same */
+static inline void shmfb_object_name(char *out, size_t n, const char *name) {
+    snprintf(out, n, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+/* Process id of the live render publishing under `object` (a full name), or 0 if there is none */
+static inline int shmfb_live_publisher(const char *object) {
+    int fd = shm_open(object, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shmfb_header))
+        map = mmap(NULL, sizeof(shmfb_header), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    const shmfb_header *h = (const shmfb_header *)map;
+    int pid = memcmp(h->magic, SHMFB_MAGIC, sizeof(h->magic)) == 0 ? h->pid : 0;
+    munmap(map, sizeof(shmfb_header));
+    if (pid <= 0 || pid == (int)getpid() || (kill(pid, 0) != 0 && errno == ESRCH))
+        return 0;
+    return pid;
+}
+
+/*
+ * Creates the object for a width x height image in tiles of tile_size,
+ * replacing one left behind under the same name by a render that has exited.
+ * Returns 0, or -1 after printing why (a live render already uses the name).
+ */
+static inline int shmfb_create(shmfb *fb, const char *name, int width, int height, int tile_size, int threads) {
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    size_t tiles_offset = (sizeof(shmfb_header) + 63) & ~(size_t)63;
+    size_t pixels_offset = tiles_offset + sizeof(shmfb_tile) * (size_t)tiles_x * tiles_y;
+    size_t size = pixels_offset + sizeof(float) * 3 * (size_t)width * height;
+
+    shmfb_object_name(fb->name, sizeof(fb->name), name);
+    int pid = shmfb_live_publisher(fb->name);
+    if (pid != 0) {
+        fprintf(stderr, "Error: shared memory %s is in use by a running render (process %d)\n", fb->name, pid);
+        return -1;
+    }
+    shm_unlink(fb->name);
+    int fd = shm_open(fb->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Failed to create shared memory %s\n", fb->name);
+        return -1;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map shared memory %s\n", fb->name);
+        shm_unlink(fb->name);
+        return -1;
+    }
+
+    /* A fresh object reads as zeros: every tile empty, every sequence even */
+    fb->header = (shmfb_header *)map;
+    fb->tiles = (shmfb_tile *)((char *)map + tiles_offset);
+    fb->rgb = (float *)((char *)map + pixels_offset);
+    fb->size = size;
+    fb->owner = 1;
+
+    shmfb_header *h = fb->header;
+    h->version = SHMFB_VERSION;
+    h->width = width;
+    h->height = height;
+    h->tile_size = tile_size;
+    h->tiles_x = tiles_x;
+    h->tiles_y = tiles_y;
+    h->threads = threads;
+    h->pid = (int32_t)getpid();
+    h->tiles_offset = tiles_offset;
+    h->pixels_offset = pixels_offset;
+    h->size = size;
+    atomic_store(&h->start_ns, shmfb_now_ns());
+    atomic_store(&h->update_ns, atomic_load(&h->start_ns));
+    atomic_thread_fence(memory_order_release);
+    memcpy(h->magic, SHMFB_MAGIC, sizeof(h->magic));
+    return 0;
+}
+
+/*
+ * Starts a frame that will render `target` pixel samples: resets the counters
+ * and empties every tile. Call while no worker is publishing.
+ */
+static inline void shmfb_begin_frame(shmfb *fb, int frame, uint64_t target) {
+    shmfb_header *h = fb->header;
+    int num_tiles = h->tiles_x * h->tiles_y;
+    for (int t = 0; t < num_tiles; t++) {
+        shmfb_tile *tile = &fb->tiles[t];
+        unsigned int seq = atomic_load_explicit(&tile->seq, memory_order_relaxed);
+        atomic_store_explicit(&tile->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        tile->frame = frame;
+        tile->samples = 0;
+        tile->passes = 0;
+        tile->busy_ns = 0;
+        atomic_store_explicit(&tile->seq, seq + 2, memory_order_release);
+    }
+    uint64_t now = shmfb_now_ns();
+    atomic_store(&h->frame, frame);
+    atomic_store(&h->state, SHMFB_RENDERING);
+    atomic_store(&h->start_ns, now);
+    atomic_store(&h->update_ns, now);
+    atomic_store(&h->target, target);
+    atomic_store(&h->samples, 0);
+    atomic_store(&h->tile_passes, 0);
+    atomic_store(&h->busy_ns, 0);
+}
+
+/*
+ * Copies pixels [x0, x1) x [y0, y1) of `acc`, one whole tile, into the object
+ * and counts `samples` pixel samples and `busy_ns` of work for it. Only one
+ * thread may publish a given tile at a time.
+ */
+static inline void shmfb_publish_tile(shmfb *fb, const accum_buffer *acc, int x0, int y0, int x1, int y1,
+                                      uint64_t samples, uint64_t busy_ns) {
+    shmfb_header *h = fb->header;
+    shmfb_tile *tile = &fb->tiles[(y0 / h->tile_size) * h->tiles_x + x0 / h->tile_size];
+    unsigned int seq = atomic_load_explicit(&tile->seq, memory_order_relaxed);
+    atomic_store_explicit(&tile->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (int y = y0; y < y1; y++) {
+        size_t src = (size_t)(y - acc->y0) * acc->width + x0;
+        size_t dst = (size_t)y * h->width + x0;
+        memcpy(&fb->rgb[dst * 3], &acc->rgb[src * 3], (size_t)(x1 - x0) * 3 * sizeof(float));
+    }
+    tile->frame = acc->frame;
+    tile->samples = acc->samples[(size_t)(y0 - acc->y0) * acc->width + x0];
+    tile->passes++;
+    tile->busy_ns += busy_ns;
+    atomic_store_explicit(&tile->seq, seq + 2, memory_order_release);
+
+    atomic_fetch_add_explicit(&h->samples, samples, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->tile_passes, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->busy_ns, busy_ns, memory_order_relaxed);
+    atomic_store_explicit(&h->update_ns, shmfb_now_ns(), memory_order_relaxed);
+}
+
+/* Publishes every tile `acc` holds, e.g. an image carried over from an earlier render */
+static inline void shmfb_publish_all(shmfb *fb, const accum_buffer *acc) {
+    int ts = fb->header->tile_size;
+    for (int y0 = acc->y0 - acc->y0 % ts; y0 < acc->y0 + acc->rows; y0 += ts) {
+        for (int x0 = 0; x0 < acc->width; x0 += ts) {
+            int x1 = x0 + ts < acc->width ? x0 + ts : acc->width;
+            int y1 = y0 + ts < acc->y0 + acc->rows ? y0 + ts : acc->y0 + acc->rows;
+            shmfb_publish_tile(fb, acc, x0, y0, x1, y1, 0, 0);
+        }
+    }
+}
+
+static inline void shmfb_finish(shmfb *fb) {
+    atomic_store_explicit(&fb->header->update_ns, shmfb_now_ns(), memory_order_relaxed);
+    atomic_store(&fb->header->state, SHMFB_DONE);
+}
+
+/* Unmaps the object; its creator also removes the name (mapped readers keep their view) */
+static inline void shmfb_close(shmfb *fb) {
+    if (!fb->header)
+        return;
+    munmap(fb->header, fb->size);
+    if (fb->owner)
+        shm_unlink(fb->name);
+    fb->header = NULL;
+}
+
+/* Maps an object published by another process read-only; returns 0, or -1 after printing why */
+static inline int shmfb_open(shmfb *fb, const char *name) {
+    shmfb_object_name(fb->name, sizeof(fb->name), name);
+    int fd = shm_open(fb->name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Failed to open shared memory %s (is a render publishing it?)\n", fb->name);
+        return -1;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shmfb_header))
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map shared memory %s\n", fb->name);
+        return -1;
+    }
+
+    const shmfb_header *h = (const shmfb_header *)map;
+    int ready = memcmp(h->magic, SHMFB_MAGIC, sizeof(h->magic)) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    if (!ready || h->version != SHMFB_VERSION || h->size != (uint64_t)st.st_size) {
+        fprintf(stderr, "Error: %s is not a framebuffer (or not ready yet)\n", fb->name);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    fb->header = (shmfb_header *)map;
+    fb->tiles = (shmfb_tile *)((char *)map + h->tiles_offset);
+    fb->rgb = (float *)((char *)map + h->pixels_offset);
+    fb->size = (size_t)st.st_size;
+    fb->owner = 0;
+    return 0;
+}
+
+/*
+ * Copies a consistent view of tile `t` into `acc` (covering the whole image)
+ * and its record into `out`. Returns 0, or -1 if the tile stayed busy, e.g.
+ * because its writer died mid-copy.
+ */
+static inline int shmfb_read_tile(const shmfb *fb, int t, accum_buffer *acc, shmfb_tile *out) {
+    const shmfb_header *h = fb->header;
+    shmfb_tile *tile = &fb->tiles[t];
+    int x0 = (t % h->tiles_x) * h->tile_size, y0 = (t / h->tiles_x) * h->tile_size;
+    int x1 = x0 + h->tile_size < h->width ? x0 + h->tile_size : h->width;
+    int y1 = y0 + h->tile_size < h->height ? y0 + h->tile_size : h->height;
+
+    for (int attempt = 0; attempt < SHMFB_READ_RETRIES; attempt++) {
+        unsigned int seq = atomic_load_explicit(&tile->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        for (int y = y0; y < y1; y++) {
+            size_t idx = (size_t)y * h->width + x0;
+            memcpy(&acc->rgb[idx * 3], &fb->rgb[idx * 3], (size_t)(x1 - x0) * 3 * sizeof(float));
+        }
+        out->frame = tile->frame;
+        out->samples = tile->samples;
+        out->passes = tile->passes;
+        out->busy_ns = tile->busy_ns;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&tile->seq, memory_order_relaxed) != seq)
+            continue;
+
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                acc->samples[(size_t)y * h->width + x] = out->samples;
+        return 0;
+    }
+    return -1;
+}
+
+#endif
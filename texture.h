@@ -92,16 +92,29 @@ static inline texture texture_perlin(vec3 c1, vec3 c2, double scale) {
     return (texture){TEXTURE_PERLIN, c1, c2, scale};
 }
 
+/* Like SCENE_USES_LAMBERTIAN etc. in material.h: 0 compiles a texture type out */
+#ifndef SCENE_USES_CHECKER
+#define SCENE_USES_CHECKER 1
+#endif
+#ifndef SCENE_USES_PERLIN
+#define SCENE_USES_PERLIN 1
+#endif
+
 static inline vec3 texture_value(texture tex, vec3 p) {
+    (void)p;    /* unused when a compiled scene has no procedural textures */
     switch (tex.type) {
+#if SCENE_USES_CHECKER
         case TEXTURE_CHECKER: {
             double sines = sin(tex.scale * p.x) * sin(tex.scale * p.y) * sin(tex.scale * p.z);
             return sines < 0 ? tex.color1 : tex.color2;
         }
+#endif
+#if SCENE_USES_PERLIN
         case TEXTURE_PERLIN: {
             double n = 0.5 * (1.0 + sin(tex.scale * p.z + 10.0 * turb(p, 7)));
             return vec3_add(vec3_scale(tex.color1, 1.0 - n), vec3_scale(tex.color2, n));
         }
+#endif
         default:
             return tex.color1;
     }
@@ -0,0 +1,86 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "vec3.h"
+#include "ray.h"
+
+/* Affine transform: 3x3 linear part plus translation, stored with its inverse */
+typedef struct {
+    double m[3][4];     /* object to world */
+    double inv[3][4];   /* world to object */
+} transform;
+
+static inline vec3 transform_apply_point(const double m[3][4], vec3 p) {
+    return (vec3){
+        m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+        m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+        m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]
+    };
+}
+
+static inline vec3 transform_apply_vector(const double m[3][4], vec3 v) {
+    return (vec3){
+        m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+        m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+        m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z
+    };
+}
+
+/* Inverts the affine matrix `a` into `out`; returns 0 if it is singular */
+static inline int transform_invert(const double a[3][4], double out[3][4]) {
+    double c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    double c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    double c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    double det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+    if (fabs(det) < 1e-12) return 0;
+    double id = 1.0 / det;
+
+    out[0][0] = c00 * id;
+    out[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * id;
+    out[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * id;
+    out[1][0] = c01 * id;
+    out[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * id;
+    out[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * id;
+    out[2][0] = c02 * id;
+    out[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * id;
+    out[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * id;
+
+    for (int i = 0; i < 3; i++)
+        out[i][3] = -(out[i][0] * a[0][3] + out[i][1] * a[1][3] + out[i][2] * a[2][3]);
+    return 1;
+}
+
+/* Scale, then rotate about the Y axis, then translate */
+static inline transform transform_create(vec3 translate, double rotate_y, vec3 scale) {
+    transform t;
+    double c = cos(rotate_y), s = sin(rotate_y);
+    double m[3][4] = {
+        { c * scale.x, 0.0,     s * scale.z, translate.x },
+        { 0.0,         scale.y, 0.0,         translate.y },
+        { -s * scale.x, 0.0,    c * scale.z, translate.z }
+    };
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+            t.m[i][j] = m[i][j];
+    if (!transform_invert(t.m, t.inv)) {
+        /* Degenerate scale: keep the identity so intersection stays well-defined */
+        return transform_create(translate, rotate_y, vec3_create(1, 1, 1));
+    }
+    return t;
+}
+
+/* World-space ray into object space; the direction is not renormalised, so t is shared */
+static inline ray transform_ray_to_object(const transform *t, ray r) {
+    return ray_create(transform_apply_point(t->inv, r.origin), transform_apply_vector(t->inv, r.direction));
+}
+
+/* Object-space normal to world space (inverse transpose), normalised */
+static inline vec3 transform_normal_to_world(const transform *t, vec3 n) {
+    return vec3_unit((vec3){
+        t->inv[0][0] * n.x + t->inv[1][0] * n.y + t->inv[2][0] * n.z,
+        t->inv[0][1] * n.x + t->inv[1][1] * n.y + t->inv[2][1] * n.z,
+        t->inv[0][2] * n.x + t->inv[1][2] * n.y + t->inv[2][2] * n.z
+    });
+}
+
+#endif
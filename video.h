@@ -0,0 +1,240 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Streams rendered frames to a pipe as YUV4MPEG2 (4:2:0, full-range BT.601)
+ * or raw RGB24, so an encoder such as ffmpeg can read them without any
+ * intermediate files. Conversion and writing run on a dedicated thread: the
+ * renderer fills one of two frame slots while the other is being written.
+ */
+typedef enum {
+    VIDEO_Y4M,
+    VIDEO_RGB24
+} video_format;
+
+#define VIDEO_SLOTS 2
+
+typedef struct {
+    FILE *out;
+    video_format format;
+    int width, height, fps;
+
+    unsigned char *slots[VIDEO_SLOTS];  /* RGB24 frames */
+    int filled[VIDEO_SLOTS];
+    int fill_slot;                      /* next slot handed to the renderer */
+    int write_slot;                     /* next slot the writer thread consumes */
+    int closing;
+    int error;
+
+    /* Writer-thread scratch: planar rows and the Y/Cb/Cr planes of one frame */
+    uint16_t *plane_r, *plane_g, *plane_b;
+    uint8_t *yuv;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} video_stream;
+
+static inline int video_chroma_width(int width) { return (width + 1) / 2; }
+static inline int video_chroma_height(int height) { return (height + 1) / 2; }
+
+/* Splits an RGB24 row into 16-bit planes, repeating the last pixel for odd widths */
+static inline void video_deinterleave_row(const uint8_t *restrict rgb, uint16_t *restrict r,
+                                          uint16_t *restrict g, uint16_t *restrict b, int width) {
+    for (int i = 0; i < width; i++) {
+        r[i] = rgb[3 * i];
+        g[i] = rgb[3 * i + 1];
+        b[i] = rgb[3 * i + 2];
+    }
+    r[width] = r[width - 1];
+    g[width] = g[width - 1];
+    b[width] = b[width - 1];
+}
+
+/* Y = 0.299 R + 0.587 G + 0.114 B in 16.16 fixed point; written to vectorise */
+static inline void video_luma_row(const uint16_t *restrict r, const uint16_t *restrict g,
+                                  const uint16_t *restrict b, uint8_t *restrict y, int width) {
+    for (int i = 0; i < width; i++)
+        y[i] = (uint8_t)((19595u * r[i] + 38470u * g[i] + 7471u * b[i] + 32768u) >> 16);
+}
+
+/*
+ * Cb/Cr of each 2x2 block from two planar rows (rows 0 and 1 of the block).
+ * The coefficients are pre-divided by the four samples being summed.
+ */
+static inline void video_chroma_row(const uint16_t *restrict r0, const uint16_t *restrict g0,
+                                    const uint16_t *restrict b0, const uint16_t *restrict r1,
+                                    const uint16_t *restrict g1, const uint16_t *restrict b1,
+                                    uint8_t *restrict cb, uint8_t *restrict cr, int chroma_width) {
+    for (int i = 0; i < chroma_width; i++) {
+        int32_t r = r0[2 * i] + r0[2 * i + 1] + r1[2 * i] + r1[2 * i + 1];
+        int32_t g = g0[2 * i] + g0[2 * i + 1] + g1[2 * i] + g1[2 * i + 1];
+        int32_t b = b0[2 * i] + b0[2 * i + 1] + b1[2 * i] + b1[2 * i + 1];
+        int32_t u = (-11059 * r - 21709 * g + 32768 * b + (128 << 18) + (1 << 17)) >> 18;
+        int32_t v = (32768 * r - 27439 * g - 5329 * b + (128 << 18) + (1 << 17)) >> 18;
+        cb[i] = (uint8_t)(u < 255 ? u : 255);  /* pure blue/red round up to 256 */
+        cr[i] = (uint8_t)(v < 255 ? v : 255);
+    }
+}
+
+/* Converts one RGB24 frame into the stream's Y, Cb and Cr planes */
+static inline void video_rgb_to_yuv420(video_stream *vs, const unsigned char *rgb) {
+    int w = vs->width, h = vs->height;
+    int cw = video_chroma_width(w), ch = video_chroma_height(h);
+    size_t stride = (size_t)w + 1;
+    uint8_t *y_plane = vs->yuv;
+    uint8_t *cb_plane = y_plane + (size_t)w * h;
+    uint8_t *cr_plane = cb_plane + (size_t)cw * ch;
+
+    for (int row = 0; row < ch; row++) {
+        int y0 = 2 * row;
+        int y1 = y0 + 1 < h ? y0 + 1 : y0;
+        uint16_t *r0 = vs->plane_r, *g0 = vs->plane_g, *b0 = vs->plane_b;
+        uint16_t *r1 = r0 + stride, *g1 = g0 + stride, *b1 = b0 + stride;
+
+        video_deinterleave_row(rgb + (size_t)y0 * w * 3, r0, g0, b0, w);
+        video_deinterleave_row(rgb + (size_t)y1 * w * 3, r1, g1, b1, w);
+        video_luma_row(r0, g0, b0, y_plane + (size_t)y0 * w, w);
+        if (y1 != y0)
+            video_luma_row(r1, g1, b1, y_plane + (size_t)y1 * w, w);
+        video_chroma_row(r0, g0, b0, r1, g1, b1,
+                         cb_plane + (size_t)row * cw, cr_plane + (size_t)row * cw, cw);
+    }
+}
+
+static inline int video_write_frame(video_stream *vs, const unsigned char *rgb) {
+    if (vs->format == VIDEO_RGB24) {
+        size_t n = (size_t)vs->width * vs->height * 3;
+        return fwrite(rgb, 1, n, vs->out) == n ? 0 : -1;
+    }
+    size_t n = (size_t)vs->width * vs->height
+             + 2 * (size_t)video_chroma_width(vs->width) * video_chroma_height(vs->height);
+    video_rgb_to_yuv420(vs, rgb);
+    if (fputs("FRAME\n", vs->out) == EOF)
+        return -1;
+    return fwrite(vs->yuv, 1, n, vs->out) == n ? 0 : -1;
+}
+
+static void *video_writer_thread(void *arg) {
+    video_stream *vs = (video_stream *)arg;
+    pthread_mutex_lock(&vs->lock);
+    for (;;) {
+        while (!vs->filled[vs->write_slot] && !vs->closing)
+            pthread_cond_wait(&vs->cond, &vs->lock);
+        if (!vs->filled[vs->write_slot])
+            break;  /* closing and drained */
+
+        int slot = vs->write_slot;
+        pthread_mutex_unlock(&vs->lock);
+        int rc = vs->error ? -1 : video_write_frame(vs, vs->slots[slot]);
+        fflush(vs->out);
+        pthread_mutex_lock(&vs->lock);
+
+        if (rc != 0)
+            vs->error = 1;
+        vs->filled[slot] = 0;
+        vs->write_slot = (slot + 1) % VIDEO_SLOTS;
+        pthread_cond_broadcast(&vs->cond);
+    }
+    pthread_mutex_unlock(&vs->lock);
+    return NULL;
+}
+
+static inline void video_free_buffers(video_stream *vs) {
+    for (int i = 0; i < VIDEO_SLOTS; i++)
+        free(vs->slots[i]);
+    free(vs->plane_r);
+    free(vs->plane_g);
+    free(vs->plane_b);
+    free(vs->yuv);
+}
+
+/* Writes the stream header and starts the writer thread; returns 0 or -1 */
+static inline int video_open(video_stream *vs, FILE *out, video_format format, int width, int height, int fps) {
+    memset(vs, 0, sizeof(*vs));
+    vs->out = out;
+    vs->format = format;
+    vs->width = width;
+    vs->height = height;
+    vs->fps = fps;
+
+    size_t frame_bytes = (size_t)width * height * 3;
+    size_t stride = (size_t)width + 1;
+    for (int i = 0; i < VIDEO_SLOTS; i++)
+        vs->slots[i] = (unsigned char *)malloc(frame_bytes);
+    vs->plane_r = (uint16_t *)malloc(2 * stride * sizeof(uint16_t));
+    vs->plane_g = (uint16_t *)malloc(2 * stride * sizeof(uint16_t));
+    vs->plane_b = (uint16_t *)malloc(2 * stride * sizeof(uint16_t));
+    vs->yuv = (uint8_t *)malloc((size_t)width * height
+                                + 2 * (size_t)video_chroma_width(width) * video_chroma_height(height));
+    int allocated = vs->plane_r && vs->plane_g && vs->plane_b && vs->yuv;
+    for (int i = 0; i < VIDEO_SLOTS; i++)
+        allocated = allocated && vs->slots[i];
+    if (!allocated) {
+        fprintf(stderr, "Error: Failed to allocate video stream buffers\n");
+        video_free_buffers(vs);
+        return -1;
+    }
+
+    if (format == VIDEO_Y4M
+        && fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps) < 0) {
+        fprintf(stderr, "Error: Failed to write video stream header\n");
+        video_free_buffers(vs);
+        return -1;
+    }
+
+    pthread_mutex_init(&vs->lock, NULL);
+    pthread_cond_init(&vs->cond, NULL);
+    if (pthread_create(&vs->thread, NULL, video_writer_thread, vs) != 0) {
+        fprintf(stderr, "Error: Failed to start video writer thread\n");
+        pthread_mutex_destroy(&vs->lock);
+        pthread_cond_destroy(&vs->cond);
+        video_free_buffers(vs);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns an RGB24 buffer for the next frame, waiting while both slots are in use */
+static inline unsigned char *video_acquire(video_stream *vs) {
+    pthread_mutex_lock(&vs->lock);
+    while (vs->filled[vs->fill_slot])
+        pthread_cond_wait(&vs->cond, &vs->lock);
+    unsigned char *buf = vs->slots[vs->fill_slot];
+    pthread_mutex_unlock(&vs->lock);
+    return buf;
+}
+
+/* Queues the buffer from video_acquire; returns -1 if an earlier write failed */
+static inline int video_submit(video_stream *vs) {
+    pthread_mutex_lock(&vs->lock);
+    vs->filled[vs->fill_slot] = 1;
+    vs->fill_slot = (vs->fill_slot + 1) % VIDEO_SLOTS;
+    int error = vs->error;
+    pthread_cond_broadcast(&vs->cond);
+    pthread_mutex_unlock(&vs->lock);
+    return error ? -1 : 0;
+}
+
+/* Drains queued frames and stops the writer; returns -1 if any write failed */
+static inline int video_close(video_stream *vs) {
+    pthread_mutex_lock(&vs->lock);
+    vs->closing = 1;
+    pthread_cond_broadcast(&vs->cond);
+    pthread_mutex_unlock(&vs->lock);
+    pthread_join(vs->thread, NULL);
+
+    int error = vs->error;
+    pthread_mutex_destroy(&vs->lock);
+    pthread_cond_destroy(&vs->cond);
+    video_free_buffers(vs);
+    return error ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "vec3.h"
+#include "ray.h"
+#include "camera.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "scene.h"
+
+/*
+ * Visibility buffer for camera rays. The first time a tile is rendered, the
+ * BVH is walked once per VIS_QUAD x VIS_QUAD pixel quad, nearest boxes first,
+ * with the volume every camera ray of the quad can sweep: the quad's rectangle
+ * on the focus plane joined to the whole lens. The quad keeps the nearest
+ * VIS_MAX_CANDIDATES primitives whose bounds that volume touches, and a bound:
+ * how far from the lens every primitive it did not keep lies. A camera ray
+ * through the quad, in this and later passes over the tile, tests the planes
+ * and the candidates; a hit closer than the bound is the hit scene_hit would
+ * find, anything else is traced through the whole scene again.
+ *
+ * The volume test is conservative: at depth z along the view the quad's rays
+ * lie within (1 - z/f) * lens + (z/f) * rect (f the focus distance). Each side
+ * of that is bounded by two planes, one tight in front of the focus plane and
+ * one behind it, and a box is kept unless it is entirely outside both planes
+ * of some side, or behind the lens. With a pinhole camera (no aperture) a
+ * sphere that every ray of the quad passes through also hides whatever lies
+ * wholly farther from the camera than its center.
+ */
+#define VIS_QUAD 2                  /* pixels per side of a quad sharing a candidate list */
+#define VIS_MAX_CANDIDATES 16       /* primitives a camera ray tests before it may fall back */
+#define VIS_HEAP 128                /* BVH nodes waiting in the nearest-first walk */
+#define VIS_MARGIN 1e-6             /* slack, relative to the view's size, against rounding */
+#define VIS_T_MIN 0.001             /* ray_color's t_min for camera rays */
+
+/* Candidate lists of one image tile, built by the thread that first renders it */
+typedef struct {
+    int quads_x;
+    uint32_t *first;        /* per quad: its first candidate in prims */
+    uint8_t *count;         /* per quad: candidates */
+    double *bound;          /* per quad: hits closer than this to the ray origin need no full trace */
+    int *prims;             /* BVH primitive indices (scene_prim_hit) */
+} vis_tile;
+
+typedef struct {
+    const scene *world;
+    camera cam;
+    int width, height;      /* full image */
+    int num_tiles;
+    vis_tile *tiles;
+    atomic_ullong quads, candidates;    /* totals over the tiles built */
+    atomic_ullong rays, traced;         /* camera rays, and those that fell back to a full trace */
+} visibility;
+
+/* The candidates a camera ray tests first; prims NULL: trace the whole scene */
+typedef struct {
+    const int *prims;
+    int count;
+    double bound;
+} vis_list;
+
+static __thread vis_list tl_primary;
+static __thread uint64_t tl_primary_traced;
+
+/* Returns 0, or -1 if out of memory; lists are built later, tile by tile */
+static inline int visibility_create(visibility *vis, const scene *world, camera cam, int width, int height,
+                                    int num_tiles) {
+    vis->world = world;
+    vis->cam = cam;
+    vis->width = width;
+    vis->height = height;
+    vis->num_tiles = num_tiles;
+    vis->tiles = (vis_tile *)calloc((size_t)num_tiles, sizeof(vis_tile));
+    atomic_init(&vis->quads, 0);
+    atomic_init(&vis->candidates, 0);
+    atomic_init(&vis->rays, 0);
+    atomic_init(&vis->traced, 0);
+    return vis->tiles ? 0 : -1;
+}
+
+/* Drops the lists of tiles [begin, end); they are built again if rendered again */
+static inline void visibility_release(visibility *vis, int begin, int end) {
+    for (int t = begin; t < end; t++) {
+        free(vis->tiles[t].first);
+        free(vis->tiles[t].count);
+        free(vis->tiles[t].bound);
+        free(vis->tiles[t].prims);
+        vis->tiles[t] = (vis_tile){0, NULL, NULL, NULL, NULL};
+    }
+}
+
+static inline void visibility_free(visibility *vis) {
+    if (!vis->tiles)
+        return;
+    visibility_release(vis, 0, vis->num_tiles);
+    free(vis->tiles);
+    vis->tiles = NULL;
+}
+
+/* A half-space dot(p, n) <= d, tested against boxes by their most negative corner */
+typedef struct {
+    vec3 n;
+    double d;
+} vis_plane;
+
+/* Two bounding planes of one side of the volume: a box is outside if outside both */
+typedef struct {
+    vis_plane near, far;
+} vis_side;
+
+static inline int vis_box_inside(const aabb *box, const vis_plane *p) {
+    double x = p->n.x > 0.0 ? box->min.x : box->max.x;
+    double y = p->n.y > 0.0 ? box->min.y : box->max.y;
+    double z = p->n.z > 0.0 ? box->min.z : box->max.z;
+    return p->n.x * x + p->n.y * y + p->n.z * z <= p->d;
+}
+
+/*
+ * Side along unit axis `a` (of u, v and their negatives) where the focus-plane
+ * rectangle reaches `bound` from the view axis. `r` is the lens radius, `f` the
+ * focus distance, `w` the camera's backward axis and `o` its center.
+ */
+static inline vis_side vis_make_side(vec3 a, double bound, double r, double f, vec3 w, vec3 o) {
+    vis_side side;
+    side.near.n = vec3_add(a, vec3_scale(w, (bound - r) / f));
+    side.near.d = r + vec3_dot(o, side.near.n);
+    side.far.n = vec3_add(a, vec3_scale(w, (bound + r) / f));
+    side.far.d = -r + vec3_dot(o, side.far.n);
+    return side;
+}
+
+static inline int vis_box_in_volume(const aabb *box, const vis_plane *behind, const vis_side *sides) {
+    if (!vis_box_inside(box, behind))
+        return 0;
+    for (int k = 0; k < 4; k++)
+        if (!vis_box_inside(box, &sides[k].near) && !vis_box_inside(box, &sides[k].far))
+            return 0;
+    return 1;
+}
+
+/* Distance from `p` to the nearest point of `box` */
+static inline double vis_box_distance(const aabb *box, vec3 p) {
+    double dx = p.x < box->min.x ? box->min.x - p.x : (p.x > box->max.x ? p.x - box->max.x : 0.0);
+    double dy = p.y < box->min.y ? box->min.y - p.y : (p.y > box->max.y ? p.y - box->max.y : 0.0);
+    double dz = p.z < box->min.z ? box->min.z - p.z : (p.z > box->max.z ? p.z - box->max.z : 0.0);
+    return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+/*
+ * With a pinhole camera: if every corner ray of the quad passes through sphere
+ * `sp` (with `slack` to spare), so does every ray of the quad, and each enters
+ * it no farther from the camera than its center. Returns that distance, or
+ * INFINITY if the sphere does not block the whole quad.
+ */
+static inline double vis_sphere_occludes(const sphere *sp, vec3 origin, const vec3 *corners, double slack) {
+    vec3 oc = vec3_sub(sp->center, origin);
+    double dist = vec3_length(oc);
+    double inner = sp->radius - slack;
+    if (inner <= 0.0 || dist - sp->radius <= slack)
+        return INFINITY;
+    for (int k = 0; k < 4; k++) {
+        vec3 d = vec3_unit(corners[k]);
+        if (vec3_dot(oc, d) <= 0.0 || vec3_length_squared(vec3_cross(oc, d)) >= inner * inner)
+            return INFINITY;
+    }
+    return dist;
+}
+
+/* Min-heap of BVH nodes by distance from the camera */
+typedef struct {
+    double dist;
+    int node;
+} vis_entry;
+
+static inline void vis_heap_push(vis_entry *heap, int *size, vis_entry e) {
+    int i = (*size)++;
+    while (i > 0 && heap[(i - 1) / 2].dist > e.dist) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static inline vis_entry vis_heap_pop(vis_entry *heap, int *size) {
+    vis_entry top = heap[0];
+    vis_entry last = heap[--*size];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= *size)
+            break;
+        if (c + 1 < *size && heap[c + 1].dist < heap[c].dist)
+            c++;
+        if (heap[c].dist >= last.dist)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * Puts the candidates of the volume of pixels [px0, px1) x [py0, py1) in `out`
+ * and returns how many; *bound gets the quad's bound, INFINITY if the list
+ * holds every primitive its rays can hit.
+ */
+static inline int vis_quad_candidates(const visibility *vis, int px0, int py0, int px1, int py1, int *out,
+                                      double *bound) {
+    const bvh *b = &vis->world->accel;
+    const camera *cam = &vis->cam;
+    double hx = vec3_dot(cam->horizontal, cam->u);
+    double vy = vec3_dot(cam->vertical, cam->v);
+    double f = vec3_dot(vec3_sub(cam->origin, cam->lower_left_corner), cam->w);
+    double margin = VIS_MARGIN * (f + hx + vy);
+    double r = cam->lens_radius + margin;
+
+    /* The quad's samples reach u in [px0, px1] / (width - 1), v likewise from the bottom row */
+    double x_lo = px0 * hx / (vis->width - 1) - 0.5 * hx - margin;
+    double x_hi = px1 * hx / (vis->width - 1) - 0.5 * hx + margin;
+    double y_lo = (vis->height - py1) * vy / (vis->height - 1) - 0.5 * vy - margin;
+    double y_hi = (vis->height - py0) * vy / (vis->height - 1) - 0.5 * vy + margin;
+
+    vis_side sides[4] = {
+        vis_make_side(cam->u, x_hi, r, f, cam->w, cam->origin),
+        vis_make_side(vec3_negate(cam->u), -x_lo, r, f, cam->w, cam->origin),
+        vis_make_side(cam->v, y_hi, r, f, cam->w, cam->origin),
+        vis_make_side(vec3_negate(cam->v), -y_lo, r, f, cam->w, cam->origin),
+    };
+    vis_plane behind = {cam->w, vec3_dot(cam->origin, cam->w) + margin};
+
+    /* Corner ray directions; rays must clear an occluder's surface by t_min of them too */
+    int pinhole = cam->lens_radius == 0.0;
+    vec3 ahead = vec3_scale(cam->w, -f);
+    vec3 corners[4] = {
+        vec3_add(ahead, vec3_add(vec3_scale(cam->u, x_lo), vec3_scale(cam->v, y_lo))),
+        vec3_add(ahead, vec3_add(vec3_scale(cam->u, x_hi), vec3_scale(cam->v, y_lo))),
+        vec3_add(ahead, vec3_add(vec3_scale(cam->u, x_lo), vec3_scale(cam->v, y_hi))),
+        vec3_add(ahead, vec3_add(vec3_scale(cam->u, x_hi), vec3_scale(cam->v, y_hi))),
+    };
+    double slack = margin + VIS_T_MIN * vec3_length(vec3_create(f, hx, vy));
+
+    /* Unlisted primitives are at least *bound away; nothing past the occluder is visible */
+    double occluder = INFINITY;
+    int n = 0;
+    *bound = INFINITY;
+    if (b->num_nodes == 0)
+        return 0;
+
+    vis_entry heap[VIS_HEAP];
+    int size = 0;
+    if (vis_box_in_volume(&b->nodes[0].box, &behind, sides))
+        vis_heap_push(heap, &size, (vis_entry){vis_box_distance(&b->nodes[0].box, cam->origin), 0});
+    while (size > 0 && heap[0].dist < *bound && heap[0].dist <= occluder + margin) {
+        vis_entry e = vis_heap_pop(heap, &size);
+        const bvh_node *node = &b->nodes[e.node];
+        if (node->count == 0) {
+            int children[2] = {e.node + 1, node->right};
+            for (int k = 0; k < 2; k++) {
+                const aabb *box = &b->nodes[children[k]].box;
+                if (!vis_box_in_volume(box, &behind, sides))
+                    continue;
+                double d = vis_box_distance(box, cam->origin);
+                if (size < VIS_HEAP)
+                    vis_heap_push(heap, &size, (vis_entry){d, children[k]});
+                else if (d < *bound)
+                    *bound = d;
+            }
+            continue;
+        }
+
+        /* Leaves are tested primitive by primitive: a leaf's box is looser than theirs */
+        for (int i = node->start; i < node->start + node->count; i++) {
+            int prim = b->prims[i];
+            aabb box = scene_prim_bounds(vis->world, prim);
+            if (!vis_box_in_volume(&box, &behind, sides))
+                continue;
+            double d = vis_box_distance(&box, cam->origin);
+            if (n == VIS_MAX_CANDIDATES) {
+                if (d < *bound)
+                    *bound = d;
+                continue;
+            }
+            out[n++] = prim;
+            if (pinhole && (uint32_t)prim < vis->world->accel_spheres) {
+                double o = vis_sphere_occludes(scene_sphere(vis->world, (scene_handle)prim), cam->origin,
+                                               corners, slack);
+                if (o < occluder)
+                    occluder = o;
+            }
+        }
+    }
+    if (size > 0 && heap[0].dist < *bound && heap[0].dist <= occluder + margin)
+        *bound = heap[0].dist;
+    if (*bound > occluder + margin)
+        *bound = INFINITY;
+
+    /* Hits are measured from the ray's own origin, anywhere on the lens */
+    *bound -= r + margin;
+    return n;
+}
+
+/*
+ * Builds the lists of image tile `tile`, pixels [x0, x1) x [y0, y1), unless
+ * built already. Returns 0, or -1 if out of memory (the tile then traces).
+ */
+static inline int visibility_build_tile(visibility *vis, int tile, int x0, int y0, int x1, int y1) {
+    vis_tile *vt = &vis->tiles[tile];
+    if (vt->count)
+        return 0;
+
+    int quads_x = (x1 - x0 + VIS_QUAD - 1) / VIS_QUAD;
+    int quads_y = (y1 - y0 + VIS_QUAD - 1) / VIS_QUAD;
+    int num_quads = quads_x * quads_y;
+    uint32_t *first = (uint32_t *)malloc(sizeof(uint32_t) * (size_t)num_quads);
+    uint8_t *count = (uint8_t *)malloc(sizeof(uint8_t) * (size_t)num_quads);
+    double *bound = (double *)malloc(sizeof(double) * (size_t)num_quads);
+    int *prims = (int *)malloc(sizeof(int) * (size_t)num_quads * VIS_MAX_CANDIDATES);
+    if (!first || !count || !bound || !prims) {
+        free(first);
+        free(count);
+        free(bound);
+        free(prims);
+        return -1;
+    }
+
+    uint32_t n = 0;
+    for (int q = 0; q < num_quads; q++) {
+        int px0 = x0 + (q % quads_x) * VIS_QUAD, py0 = y0 + (q / quads_x) * VIS_QUAD;
+        int px1 = px0 + VIS_QUAD < x1 ? px0 + VIS_QUAD : x1;
+        int py1 = py0 + VIS_QUAD < y1 ? py0 + VIS_QUAD : y1;
+        int c = vis_quad_candidates(vis, px0, py0, px1, py1, &prims[n], &bound[q]);
+        first[q] = n;
+        count[q] = (uint8_t)c;
+        n += (uint32_t)c;
+    }
+
+    /* Kept at its used size: most quads see a handful of primitives */
+    int *fitted = (int *)realloc(prims, sizeof(int) * (n ? n : 1));
+    vt->prims = fitted ? fitted : prims;
+    vt->first = first;
+    vt->bound = bound;
+    vt->quads_x = quads_x;
+    vt->count = count;
+    atomic_fetch_add(&vis->quads, (uint64_t)num_quads);
+    atomic_fetch_add(&vis->candidates, n);
+    return 0;
+}
+
+/* List of the quad of tile `tile` (built, with corner x0, y0) that pixel (x, y) is in */
+static inline vis_list visibility_list(const visibility *vis, int tile, int x0, int y0, int x, int y) {
+    const vis_tile *vt = &vis->tiles[tile];
+    if (!vt->count)
+        return (vis_list){NULL, 0, 0.0};
+    int q = (y - y0) / VIS_QUAD * vt->quads_x + (x - x0) / VIS_QUAD;
+    return (vis_list){&vt->prims[vt->first[q]], vt->count[q], vt->bound[q]};
+}
+
+/*
+ * Closest hit of camera ray `r` among the planes and the listed primitives,
+ * when it is nearer than the list's bound and so scene_hit's answer too.
+ * Returns -1 if the ray needs a full trace instead.
+ */
+static inline int visibility_hit(const scene *s, vis_list list, ray r, double t_min, double t_max,
+                                 hit_record *rec) {
+    hit_record temp_rec;
+    double closest_so_far = t_max;
+    int hit_anything = scene_planes_hit(s, r, t_min, &closest_so_far, rec);
+    for (int i = 0; i < list.count; i++) {
+        if (scene_prim_hit(s, list.prims[i], r, t_min, closest_so_far, &temp_rec)) {
+            hit_anything = 1;
+            closest_so_far = temp_rec.t;
+            *rec = temp_rec;
+        }
+    }
+    if (list.bound == INFINITY || (hit_anything && closest_so_far * vec3_length(r.direction) < list.bound))
+        return hit_anything;
+    return -1;
+}
+
+#endif